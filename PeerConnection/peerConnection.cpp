@@ -1,21 +1,40 @@
 #include "peerConnection.hpp"
-#include <shared_mutex>
 #include <unistd.h>
 #include <iostream>
 #include <cstring>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <algorithm>
 
-PeerConnection::PeerConnection(std::string ip, uint16_t port, std::shared_mutex* bitfield_mutex, std::vector<uint8_t>* global_bitfield, PieceManager* piece_manager) {
+PeerConnection::PeerConnection(std::string ip, uint16_t port, PieceManager* piece_manager) {
     this->ip = ip;
     this->port = port;
     this->sockfd = -1;
-    this->bitfield_mutex = bitfield_mutex;
-    this->global_bitfield = global_bitfield;
+    this->global_bitfield = &piece_manager->getBitfield();
     this->piece_manager = piece_manager;
+    this->state_since = std::chrono::steady_clock::now();
+    this->last_recv = this->state_since;
+    this->window_start = this->state_since;
+    this->upload_window_start = this->state_since;
+    this->min_rtt_since = this->state_since;
+    this->peer_bitfield.assign(global_bitfield->wordCount(), 0);
+    this->peer_id = piece_manager->registerPeer();
+    // Il ring deve contenere per intero handshake e BITFIELD
+    this->in_ring.reset(std::max<size_t>(16384, 68 + 5 + global_bitfield->byteSize()));
 }
 
 PeerConnection::~PeerConnection(){
+    if (block.active && block.dest) {
+        piece_manager->abortBlock(block.index, block.begin);
+    }
+    if (!pending_requests.empty()) {
+        piece_manager->releaseBlocks(peer_id);
+    }
+    if (peer_piece_count > 0) {
+        piece_manager->peerDisconnected(peerBytes());
+    }
     if (sockfd != -1){
         close(sockfd);
     }
@@ -23,65 +42,33 @@ PeerConnection::~PeerConnection(){
 
 
 bool PeerConnection::connectToPeer() {
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (sockfd < 0) return false;
 
-
-    int flags = fcntl(sockfd, F_GETFL, 0);
-    fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
-
     struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
     addr.sin_port = htons(port);
-    inet_pton(AF_INET, ip.c_str(), &addr.sin_addr);
-
+    if (inet_pton(AF_INET, ip.c_str(), &addr.sin_addr) != 1) return false;
 
     int res = connect(sockfd, (struct sockaddr*)&addr, sizeof(addr));
+    if (res < 0 && errno != EINPROGRESS) return false;
 
-    time_t timeout = 1; 
-
-    if (res < 0) {
-        if (errno == EINPROGRESS) {
-            
-            fd_set set;
-            FD_ZERO(&set);
-            FD_SET(sockfd, &set);
-
-            struct timeval tv;
-            tv.tv_sec = timeout;
-            tv.tv_usec = 0;
-
-            
-            res = select(sockfd + 1, NULL, &set, NULL, &tv);
-
-            if (res <= 0) {
-                
-                return false;
-            } else {
-                
-                int so_error;
-                socklen_t len = sizeof(so_error);
-                getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &so_error, &len);
-                if (so_error != 0) return false;
-            }
-        } else {
-            return false;
-        }
-    }
-
-    
-    fcntl(sockfd, F_SETFL, flags);
-
-    
-    struct timeval timeout_recv = {timeout, 0};
-    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout_recv, sizeof(timeout_recv));
-
+    state = State::CONNECTING;
+    state_since = std::chrono::steady_clock::now();
     return true;
 }
 
+void PeerConnection::acceptFrom(int fd) {
+    sockfd = fd;
+    state = State::HANDSHAKE;
+    state_since = std::chrono::steady_clock::now();
+    last_recv = state_since;
+}
+
 
 
-bool PeerConnection::sendHandshake(const std::string& infoHash, const std::string& peerId) {
+void PeerConnection::sendHandshake(const std::string& infoHash, const std::string& peerId) {
     uint8_t handshake[68];
     
     handshake[0] = 19; 
@@ -90,173 +77,373 @@ bool PeerConnection::sendHandshake(const std::string& infoHash, const std::strin
     std::memcpy(&handshake[28], infoHash.data(), 20); 
     std::memcpy(&handshake[48], peerId.data(), 20);   
 
-    return send(sockfd, handshake, 68, 0) == 68;
+    this->expected_hash = infoHash;
+    queueSend(handshake, sizeof(handshake));
 }
 
-bool PeerConnection::receiveHandshake(const std::string& expectedHash) {
-    uint8_t response[68];
-    ssize_t bytesRead = recv(sockfd, response, 68, 0);
+bool PeerConnection::receiveHandshake() {
+    if (in_ring.size() < 68) return true;
 
-    if (bytesRead < 68) {
-        //std::cerr << "Risposta handshake incompleta da " << ip << std::endl;
+    uint8_t response[68];
+    in_ring.peek(response, sizeof(response));
+    if (std::memcmp(&response[28], expected_hash.data(), 20) != 0) {
+        std::cerr << "Info-hash non corrispondente!" << std::endl;
         return false;
     }
+    in_ring.consume(68);
+
+    //std::cout << "Handshake completato con successo con " << ip << std::endl;
+    state = State::ACTIVE;
+    state_since = std::chrono::steady_clock::now();
+    sendBitfield();
+    return true;
+}
 
 
-    if (std::memcmp(&response[28], expectedHash.data(), 20) != 0) {
-        std::cerr << "Info-hash non corrispondente!" << std::endl;
-        return false;
+
+void PeerConnection::startBlock(uint32_t index, uint32_t begin, uint32_t length) {
+    block.active = true;
+    block.is_piece = true;
+    block.index = index;
+    block.begin = begin;
+    block.length = length;
+    block.filled = 0;
+    block.dest = piece_manager->reserveBlock(index, begin, length);
+}
+
+
+void PeerConnection::finishBlock() {
+    block.active = false;
+    if (!block.is_piece) return;
+
+    for (size_t i = 0; i < pending_requests.size(); ++i) {
+        if (pending_requests[i].req.index == block.index && pending_requests[i].req.begin == block.begin) {
+            onBlockReceived(block.length, pending_requests[i].sent);
+            pending_requests.erase(pending_requests.begin() + i);
+            break;
+        }
     }
 
-    //std::cout << "Handshake completato con successo con " << ip << std::endl;
+    if (block.dest) {
+        block.dest = nullptr;
+        piece_manager->commitBlock(block.index, block.begin, block.length, peer_id);
+    } else {
+        piece_manager->discardBlock(block.length);
+    }
+}
+
+
+bool PeerConnection::processInput() {
+    if (state == State::HANDSHAKE) {
+        if (!receiveHandshake()) return false;
+        if (state != State::ACTIVE) return true;
+    }
+
+    while (state == State::ACTIVE) {
+        if (block.active) {
+            // Byte del corpo arrivati insieme all'header: unica copia dal ring
+            size_t take = std::min<size_t>(in_ring.size(), block.length - block.filled);
+            if (take > 0) {
+                if (block.dest) in_ring.peek(block.dest + block.filled, take);
+                in_ring.consume(take);
+                block.filled += take;
+            }
+            if (block.filled < block.length) break;
+            finishBlock();
+            continue;
+        }
+
+        if (in_ring.size() < 4) break;
+        uint32_t len_net;
+        in_ring.peek(&len_net, 4);
+        uint32_t length = ntohl(len_net);
+
+        if (length == 0) {
+            in_ring.consume(4);
+            continue;
+        }
+        if (in_ring.size() < 5) break;
+        uint8_t id = in_ring.at(4);
+
+        if (id == 7 && length >= 9) {
+            if (in_ring.size() < 13) break;
+            uint32_t header[2];
+            in_ring.peek(header, 8, 5);
+            in_ring.consume(13);
+            startBlock(ntohl(header[0]), ntohl(header[1]), length - 9);
+            continue;
+        }
+
+        if (4 + (size_t)length > in_ring.capacity()) {
+            // Non entra nel ring: il contenuto viene scartato man mano che arriva
+            in_ring.consume(5);
+            block = IncomingBlock{};
+            block.active = true;
+            block.length = length - 1;
+            continue;
+        }
+
+        if (in_ring.size() < 4 + (size_t)length) break;
+        in_msg.length = length;
+        in_msg.id = id;
+        in_msg.payload.resize(length - 1);
+        in_ring.peek(in_msg.payload.data(), length - 1, 5);
+        in_ring.consume(4 + length);
+        handleMessage(in_msg);
+    }
     return true;
 }
 
 
+bool PeerConnection::onReadable() {
+    const size_t MAX_READ_PER_EVENT = 256 * 1024;
+    // Dopo un corpo si legge solo quanto basta per l'header del PIECE successivo,
+    // cosi' il corpo seguente finisce anch'esso direttamente nel buffer del pezzo.
+    const size_t LOOKAHEAD = 13;
+    size_t total = 0;
 
+    while (total < MAX_READ_PER_EVENT) {
+        struct iovec iov[3];
+        int cnt;
+        size_t direct = 0;
 
-PeerConnection::BTMessage PeerConnection::readMessage() {
-    BTMessage msg;
-    uint32_t len_net;
+        if (block.active && block.dest && block.filled < block.length) {
+            direct = block.length - block.filled;
+            iov[0].iov_base = block.dest + block.filled;
+            iov[0].iov_len = direct;
+            cnt = 1 + in_ring.writable(iov + 1, LOOKAHEAD);
+        } else {
+            cnt = in_ring.writable(iov, in_ring.space());
+            if (cnt == 0) return false;
+        }
 
-    
-    if (!readAll(&len_net, 4)) {
-        return {0, 0, {}}; 
+        ssize_t n = readv(sockfd, iov, cnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return false;
+        }
+        if (n == 0) {
+            // Il peer ha chiuso: i messaggi gia' completi nel ring vanno gestiti comunque
+            processInput();
+            return false;
+        }
+
+        size_t toBlock = std::min<size_t>(n, direct);
+        block.filled += toBlock;
+        in_ring.produce(n - toBlock);
+
+        total += n;
+        last_recv = std::chrono::steady_clock::now();
+
+        if (!processInput()) return false;
     }
-    msg.length = ntohl(len_net);
 
-    
-    if (msg.length == 0) {
-        return {0, 0xFF, {}}; 
+    if (state == State::ACTIVE) fillPipeline();
+    return flush();
+}
+
+
+bool PeerConnection::onWritable() {
+    if (state == State::CONNECTING) {
+        int so_error = 0;
+        socklen_t len = sizeof(so_error);
+        getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+        if (so_error != 0) return false;
+
+        state = State::HANDSHAKE;
+        state_since = std::chrono::steady_clock::now();
+        last_recv = state_since;
     }
+    return flush();
+}
 
 
-    if (!readAll(&msg.id, 1)) {
-        return {0, 0, {}};
+bool PeerConnection::onTick(std::chrono::steady_clock::time_point now) {
+    const auto CONNECT_TIMEOUT = std::chrono::seconds(3);
+    const auto HANDSHAKE_TIMEOUT = std::chrono::seconds(10);
+    const auto IDLE_TIMEOUT = std::chrono::seconds(10);
+
+    switch (state) {
+        case State::CONNECTING: return now - state_since < CONNECT_TIMEOUT;
+        case State::HANDSHAKE:  return now - state_since < HANDSHAKE_TIMEOUT;
+        case State::ACTIVE:
+            updatePipelineDepth(now);
+            updateUploadRate(now);
+            // Coda vuota: il budget dei buffer puo' essersi liberato nel frattempo
+            if (pending_requests.empty()) {
+                fillPipeline();
+                if (!flush()) return false;
+            }
+            return now - last_recv < IDLE_TIMEOUT;
+        default:                return false;
     }
+}
+
+
+void PeerConnection::queueSend(const void* data, size_t len) {
+    const uint8_t* ptr = static_cast<const uint8_t*>(data);
+    out_buffer.insert(out_buffer.end(), ptr, ptr + len);
+}
+
 
+bool PeerConnection::flush() {
+    const size_t MAX_WRITE_PER_EVENT = 256 * 1024;
+    size_t total = 0;
 
-    if (msg.length > 1) {
-        msg.payload.resize(msg.length - 1);
-        if (!readAll(msg.payload.data(), msg.length - 1)) {
-            return {0, 0, {}};
+    while (total < MAX_WRITE_PER_EVENT) {
+        ssize_t n;
+        if (upload.active) {
+            if (upload.header_sent < sizeof(upload.header)) {
+                // MSG_MORE: header e primo tratto del corpo nello stesso segmento
+                n = send(sockfd, upload.header + upload.header_sent, sizeof(upload.header) - upload.header_sent, MSG_NOSIGNAL | MSG_MORE);
+                if (n > 0) upload.header_sent += n;
+            } else {
+                n = piece_manager->sendBlock(sockfd, upload.index, upload.begin + upload.sent, upload.length - upload.sent);
+                if (n > 0) {
+                    upload.sent += n;
+                    upload_window_bytes += n;
+                    piece_manager->addUploaded(n);
+                    if (upload.sent == upload.length) upload.active = false;
+                }
+            }
+        } else if (out_offset < out_buffer.size()) {
+            n = send(sockfd, out_buffer.data() + out_offset, out_buffer.size() - out_offset, MSG_NOSIGNAL);
+            if (n > 0) out_offset += n;
+        } else if (!upload_queue.empty()) {
+            startUpload();
+            continue;
+        } else {
+            break;
         }
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            state = State::CLOSED;
+            return false;
+        }
+        total += n;
     }
 
-    return msg;
+    if (out_offset == out_buffer.size()) {
+        out_buffer.clear();
+        out_offset = 0;
+    }
+    return true;
 }
 
 
+void PeerConnection::queueUpload(uint32_t index, uint32_t begin, uint32_t length) {
+    const uint32_t MAX_REQUEST_LENGTH = 128 * 1024;
+    const size_t MAX_UPLOAD_QUEUE = 256;
+
+    if (am_choking || index >= piece_manager->getNumPieces() || !global_bitfield->test(index)) return;
+    if (length == 0 || length > MAX_REQUEST_LENGTH) return;
+    if ((uint64_t)begin + length > piece_manager->getPieceLength(index)) return;
+    // Coda piena: la richiesta in piu' viene ignorata, il peer la ripetera'
+    if (upload_queue.size() >= MAX_UPLOAD_QUEUE) return;
+    upload_queue.push_back({index, begin, length});
+}
+
+
+void PeerConnection::startUpload() {
+    PieceManager::BlockRequest req = upload_queue.front();
+    upload_queue.pop_front();
+
+    uint32_t msg_len = htonl(9 + req.length);
+    uint32_t n_index = htonl(req.index);
+    uint32_t n_begin = htonl(req.begin);
+    memcpy(upload.header, &msg_len, 4);
+    upload.header[4] = 7;
+    memcpy(upload.header + 5, &n_index, 4);
+    memcpy(upload.header + 9, &n_begin, 4);
+
+    upload.active = true;
+    upload.header_sent = 0;
+    upload.index = req.index;
+    upload.begin = req.begin;
+    upload.length = req.length;
+    upload.sent = 0;
+}
 
-void PeerConnection::handleMessage(const BTMessage& msg) {
 
-    const int PIPELINE_SIZE = 100;
-    const int BLOCK_SIZE = 16384;
+void PeerConnection::handleMessage(const BTMessage& msg) {
 
     switch (msg.id) {
         case 0: 
             //std::cout << "[Msg] CHOKE" << std::endl;
             peer_choking = true;
+            // Le richieste pendenti sono scartate dal peer: altri possono riprenderle
+            if (!pending_requests.empty()) {
+                pending_requests.clear();
+                piece_manager->releaseBlocks(peer_id);
+            }
             break;
         
         case 1: 
             this->peer_choking = false;
-            {
-                int pieceToRequest = this->piece_manager->pickPiece(this->peer_bitfield);
-                if (pieceToRequest != -1) {
-                    
-
-                    uint32_t currentPieceLen = this->piece_manager->getPieceLength(pieceToRequest);
-
-                    for (int i = 0; i < PIPELINE_SIZE; ++i) {
-                        uint32_t offset = i * BLOCK_SIZE;
-                        
-                        if (offset < currentPieceLen) {
-                            
-                            
-                            uint32_t blockSize = BLOCK_SIZE;
-                            if (offset + blockSize > currentPieceLen) {
-                                blockSize = currentPieceLen - offset;
-                            }
-
-                            this->sendRequest(pieceToRequest, offset, blockSize);
-                        }
-                    }
-                }
-            }
+            break;
+
+        case 2:
+            // Lo sblocco lo decide il choker del reactor
+            peer_interested = true;
+            break;
+
+        case 3:
+            peer_interested = false;
             break;
 
         case 4: 
             if (msg.payload.size() == 4) {
                 uint32_t index = ntohl(*reinterpret_cast<const uint32_t*>(msg.payload.data()));
                 size_t byteIdx = index / 8;
-                if (byteIdx < peer_bitfield.size()) {
-                    peer_bitfield[byteIdx] |= (1 << (7 - (index % 8)));
+                uint8_t mask = 1 << (7 - (index % 8));
+                if (index < piece_manager->getNumPieces() && !(peerBytes()[byteIdx] & mask)) {
+                    peerBytes()[byteIdx] |= mask;
+                    peer_piece_count++;
+                    piece_manager->peerHave(index);
+                    // Basta guardare il pezzo appena annunciato, non serve riscandire il bitfield
+                    if (!this->am_interested && !global_bitfield->test(index)) sendInterested();
                 }
-                if (!this->am_interested && am_Interested()) sendInterested();
             }
             break;
 
         case 5: 
-            this->peer_bitfield = msg.payload;
+            if (peer_piece_count > 0) piece_manager->peerDisconnected(peerBytes());
+            {
+                // Stesso layout del bitfield globale: i bit oltre l'ultimo pezzo vanno spenti
+                // prima di confrontare a parole
+                std::fill(peer_bitfield.begin(), peer_bitfield.end(), 0);
+                std::memcpy(peerBytes(), msg.payload.data(), std::min(msg.payload.size(), global_bitfield->byteSize()));
+                peer_bitfield.back() &= global_bitfield->validMask(peer_bitfield.size() - 1);
+
+                peer_piece_count = bitfield_ops::count(peer_bitfield.data(), peer_bitfield.size());
+            }
+            piece_manager->peerBitfield(peerBytes());
             if (!this->am_interested && am_Interested()) {
                 sendInterested();
             }
             break;
         
-        case 7: { 
-            if (msg.payload.size() >= 8) {
-                uint32_t index = ntohl(*reinterpret_cast<const uint32_t*>(msg.payload.data()));
-                uint32_t begin = ntohl(*reinterpret_cast<const uint32_t*>(msg.payload.data() + 4));
-                const uint8_t* blockData = msg.payload.data() + 8;
-                size_t blockSize = msg.payload.size() - 8;
-
-                bool isComplete = this->piece_manager->addBlock(index, begin, blockData, blockSize);
-
-                if (!peer_choking) {
-                    if (isComplete) {
-
-                        int nextPiece = this->piece_manager->pickPiece(this->peer_bitfield);
-                        if (nextPiece != -1) {
-                            
-
-                            uint32_t nextPieceLen = this->piece_manager->getPieceLength(nextPiece);
-
-                            for (int i = 0; i < PIPELINE_SIZE; ++i) {
-                                uint32_t offset = i * BLOCK_SIZE;
-                                if (offset < nextPieceLen) {
-                                    
-
-                                    uint32_t reqSize = BLOCK_SIZE;
-                                    if (offset + reqSize > nextPieceLen) {
-                                        reqSize = nextPieceLen - offset;
-                                    }
-
-                                    this->sendRequest(nextPiece, offset, reqSize);
-                                }
-                            }
-                        }
-                    } else {
-                        
-                        uint32_t currentPieceLen = this->piece_manager->getPieceLength(index);
-
-                        uint32_t nextRequestOffset = begin + (PIPELINE_SIZE * BLOCK_SIZE);
-                        
-                        if (nextRequestOffset < currentPieceLen) {
-                            
-                            
-                            uint32_t reqSize = BLOCK_SIZE;
-                            if (nextRequestOffset + reqSize > currentPieceLen) {
-                                reqSize = currentPieceLen - nextRequestOffset;
-                            }
-
-                            this->sendRequest(index, nextRequestOffset, reqSize);
-                        }
-                    }
-                }
+        case 6:
+            if (msg.payload.size() == 12) {
+                const uint32_t* fields = reinterpret_cast<const uint32_t*>(msg.payload.data());
+                queueUpload(ntohl(fields[0]), ntohl(fields[1]), ntohl(fields[2]));
+            }
+            break;
+
+        case 8:
+            // Un blocco gia' iniziato va comunque concluso: il flusso non si puo' interrompere
+            if (msg.payload.size() == 12) {
+                const uint32_t* fields = reinterpret_cast<const uint32_t*>(msg.payload.data());
+                uint32_t index = ntohl(fields[0]), begin = ntohl(fields[1]), length = ntohl(fields[2]);
+                auto it = std::find_if(upload_queue.begin(), upload_queue.end(), [&](const PieceManager::BlockRequest& r) {
+                    return r.index == index && r.begin == begin && r.length == length;
+                });
+                if (it != upload_queue.end()) upload_queue.erase(it);
             }
             break;
-        }
 
         case 0xFF: 
             break;
@@ -266,33 +453,68 @@ void PeerConnection::handleMessage(const BTMessage& msg) {
     }
 }
 
-void PeerConnection::startMessageLoop() {
-    sendBitfield();
+void PeerConnection::fillPipeline() {
+    if (peer_choking || pending_requests.size() >= pipeline_depth) return;
 
+    // assignBlocks prosegue da solo nel pezzo successivo: la coda non si svuota ai confini
+    std::vector<PieceManager::BlockRequest> fresh;
+    piece_manager->assignBlocks(peer_id, peerBytes(), peer_piece_count, pipeline_depth - pending_requests.size(), fresh);
 
-    while (true) {
-        BTMessage msg = readMessage();
-        
-        if (msg.length == 0 && msg.id == 0) { 
-             //std::cout << "Connessione chiusa dal peer " << ip << std::endl;
-             break;
-        }
-        
-        handleMessage(msg);
+    auto now = std::chrono::steady_clock::now();
+    for (const auto& req : fresh) {
+        sendRequest(req.index, req.begin, req.length);
+        pending_requests.push_back({req, now});
     }
 }
 
+void PeerConnection::onBlockReceived(size_t bytes, std::chrono::steady_clock::time_point sent) {
+    const auto MIN_RTT_WINDOW = std::chrono::seconds(10);
 
-bool PeerConnection::am_Interested() {
-    std::shared_lock<std::shared_mutex> lock(*this->bitfield_mutex);
-    
-    size_t limit = std::min(peer_bitfield.size(), global_bitfield->size());
-    for (size_t i = 0; i < limit; ++i) {
-        if ((peer_bitfield[i] & ~((*global_bitfield)[i])) != 0) {
-            return true;
-        }
+    auto now = std::chrono::steady_clock::now();
+    auto rtt = now - sent;
+    window_bytes += bytes;
+
+    // Il minimo viene dimenticato periodicamente per seguire cambi di percorso
+    if (min_rtt == std::chrono::steady_clock::duration::zero() || rtt < min_rtt || now - min_rtt_since > MIN_RTT_WINDOW) {
+        min_rtt = rtt;
+        min_rtt_since = now;
     }
-    return false;
+}
+
+void PeerConnection::updatePipelineDepth(std::chrono::steady_clock::time_point now) {
+    const size_t MIN_DEPTH = 4;
+    const size_t MAX_DEPTH = 512;
+    const double BLOCK_SIZE = 16384;
+
+    double elapsed = std::chrono::duration<double>(now - window_start).count();
+    if (elapsed < 1.0) return;
+
+    double sample = window_bytes / elapsed;
+    download_rate = (download_rate == 0) ? sample : 0.7 * download_rate + 0.3 * sample;
+    window_bytes = 0;
+    window_start = now;
+
+    if (min_rtt == std::chrono::steady_clock::duration::zero() || download_rate == 0) return;
+
+    // Con margine 2x la coda raddoppia finche' la banda non smette di crescere,
+    // poi si stabilizza intorno al doppio del prodotto banda-ritardo.
+    double bdp = download_rate * std::chrono::duration<double>(min_rtt).count() / BLOCK_SIZE;
+    size_t depth = (size_t)(2 * bdp) + 2;
+    pipeline_depth = std::clamp(depth, MIN_DEPTH, MAX_DEPTH);
+}
+
+void PeerConnection::updateUploadRate(std::chrono::steady_clock::time_point now) {
+    double elapsed = std::chrono::duration<double>(now - upload_window_start).count();
+    if (elapsed < 1.0) return;
+
+    double sample = upload_window_bytes / elapsed;
+    upload_rate = (upload_rate == 0) ? sample : 0.7 * upload_rate + 0.3 * sample;
+    upload_window_bytes = 0;
+    upload_window_start = now;
+}
+
+bool PeerConnection::am_Interested() {
+    return bitfield_ops::any_andnot(peer_bitfield.data(), global_bitfield->raw(), peer_bitfield.size());
 }
 
 void PeerConnection::sendInterested() {
@@ -306,17 +528,60 @@ void PeerConnection::sendInterested() {
     memcpy(message, &length, 4);
     message[4] = id;
 
-    ssize_t sent = send(sockfd, message, sizeof(message), 0);
+    queueSend(message, sizeof(message));
+    this->am_interested = true;
+    //std::cout << "[Out] Inviato messaggio INTERESTED a " << ip << std::endl;
+}
+
 
-    if (sent == sizeof(message)) {
-        this->am_interested = true;
-        //std::cout << "[Out] Inviato messaggio INTERESTED a " << ip << std::endl;
+void PeerConnection::sendUnchoke() {
+    uint32_t length = htonl(1);
+    uint8_t message[5];
+    memcpy(message, &length, 4);
+    message[4] = 1;
+
+    queueSend(message, sizeof(message));
+    am_choking = false;
+}
+
+
+void PeerConnection::sendChoke() {
+    uint32_t length = htonl(1);
+    uint8_t message[5];
+    memcpy(message, &length, 4);
+    message[4] = 0;
+
+    queueSend(message, sizeof(message));
+    am_choking = true;
+}
+
+
+void PeerConnection::setChoking(bool choke) {
+    if (state != State::ACTIVE || choke == am_choking) return;
+    if (choke) {
+        sendChoke();
+        // Le richieste non servite sono implicitamente scartate dal CHOKE
+        upload_queue.clear();
     } else {
-        //std::cerr << "[Err] Errore nell'invio del messaggio INTERESTED" << std::endl;
+        sendUnchoke();
     }
 }
 
 
+void PeerConnection::sendHave(uint32_t index) {
+    if (state != State::ACTIVE) return;
+
+    uint32_t msg_len = htonl(5);
+    uint32_t n_index = htonl(index);
+    uint8_t packet[9];
+    memcpy(packet, &msg_len, 4);
+    packet[4] = 4;
+    memcpy(packet + 5, &n_index, 4);
+
+    queueSend(packet, sizeof(packet));
+}
+
+
 void PeerConnection::sendRequest(uint32_t index, uint32_t begin, uint32_t length) {
     uint32_t msg_len = htonl(13); 
     uint8_t id = 6;
@@ -332,18 +597,40 @@ void PeerConnection::sendRequest(uint32_t index, uint32_t begin, uint32_t length
     memcpy(packet + 9, &n_begin, 4);
     memcpy(packet + 13, &n_length, 4);
 
-    send(sockfd, packet, 17, 0);
+    queueSend(packet, 17);
     //std::cout << "[Out] Richiesto pezzo #" << index << " blocco " << begin << std::endl;
 }
 
 
+void PeerConnection::sendCancel(uint32_t index, uint32_t begin, uint32_t length) {
+    auto it = std::find_if(pending_requests.begin(), pending_requests.end(), [&](const PendingRequest& r) {
+        return r.req.index == index && r.req.begin == begin;
+    });
+    if (it == pending_requests.end()) return;
+    pending_requests.erase(it);
+
+    uint32_t msg_len = htonl(13);
+    uint8_t id = 8;
+
+    uint32_t n_index = htonl(index);
+    uint32_t n_begin = htonl(begin);
+    uint32_t n_length = htonl(length);
+
+    uint8_t packet[17];
+    memcpy(packet, &msg_len, 4);
+    packet[4] = id;
+    memcpy(packet + 5, &n_index, 4);
+    memcpy(packet + 9, &n_begin, 4);
+    memcpy(packet + 13, &n_length, 4);
+
+    queueSend(packet, 17);
+}
+
+
 void PeerConnection::sendBitfield() {
 
     std::vector<uint8_t> current_bf;
-    {
-        std::shared_lock<std::shared_mutex> lock(*bitfield_mutex);
-        current_bf = *global_bitfield;
-    }
+    global_bitfield->toBytes(current_bf);
 
     uint32_t msg_len = htonl(1 + current_bf.size());
     uint8_t id = 5;
@@ -356,25 +643,6 @@ void PeerConnection::sendBitfield() {
     ptr[4] = id;
     memcpy(ptr + 5, current_bf.data(), current_bf.size());
 
-    send(sockfd, packet.data(), packet.size(), 0);
+    queueSend(packet.data(), packet.size());
     //std::cout << "[Out] Inviato il mio BITFIELD (" << current_bf.size() << " byte)" << std::endl;
 }
-
-
-bool PeerConnection::readAll(void* buf, size_t len) {
-    size_t total_read = 0;
-    char* ptr = static_cast<char*>(buf);
-
-    while (total_read < len) {
-        ssize_t n = recv(sockfd, ptr + total_read, len - total_read, 0);
-        
-        if (n < 0) {
-            if (errno == EINTR) continue; 
-            return false; 
-        }
-        if (n == 0) return false; 
-
-        total_read += n;
-    }
-    return true;
-}
\ No newline at end of file
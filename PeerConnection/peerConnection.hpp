@@ -3,10 +3,11 @@
 
 #include <string>
 #include <vector>
+#include <chrono>
+#include <deque>
 #include <arpa/inet.h>
-#include <shared_mutex>
-#include <mutex>
 #include "../PieceManager/pieceManager.hpp"
+#include "ringBuffer.hpp"
 
 class PeerConnection {
 public:
@@ -17,43 +18,149 @@ public:
     std::vector<uint8_t> payload;
     };
 
-    PeerConnection(std::string ip, uint16_t port, std::shared_mutex* bitfield_mutex, std::vector<uint8_t>* global_bitfield, PieceManager* piece_manager);
-    ~PeerConnection();
+    enum class State { CONNECTING, HANDSHAKE, ACTIVE, CLOSED };
 
-    BTMessage readMessage();
+    PeerConnection(std::string ip, uint16_t port, PieceManager* piece_manager);
+    ~PeerConnection();
 
+    // Connessione non bloccante: il completamento arriva come evento EPOLLOUT
     bool connectToPeer();
-    bool sendHandshake(const std::string& infoHash, const std::string& peerId);
-    bool receiveHandshake(const std::string& expectedHash);
+    // Connessione in ingresso gia' accettata: si passa subito all'handshake
+    void acceptFrom(int fd);
+    void sendHandshake(const std::string& infoHash, const std::string& peerId);
 
-    void sendRequest(uint32_t index, uint32_t begin, uint32_t length);
+    // Chiamati dal reactor: restituiscono false se la connessione va chiusa
+    bool onReadable();
+    bool onWritable();
+    bool onTick(std::chrono::steady_clock::time_point now);
+
+    bool wantsWrite() const {
+        return state == State::CONNECTING || out_offset < out_buffer.size() || upload.active || !upload_queue.empty();
+    }
+    int getSocket() const { return sockfd; }
+    const std::string& getIp() const { return ip; }
+    uint16_t getPort() const { return port; }
+
+    uint32_t getId() const { return peer_id; }
+
+    // Per il choker: velocita' medie sull'ultimo periodo, in byte/s
+    bool isActive() const { return state == State::ACTIVE; }
+    bool peerInterested() const { return peer_interested; }
+    double downloadRate() const { return download_rate; }
+    double uploadRate() const { return upload_rate; }
+    // CHOKE svuota anche le richieste in coda; il blocco in invio viene concluso
+    void setChoking(bool choke);
 
-    void startMessageLoop();
+    void sendRequest(uint32_t index, uint32_t begin, uint32_t length);
+    // Endgame: il blocco e' arrivato da un altro peer
+    void sendCancel(uint32_t index, uint32_t begin, uint32_t length);
 
     void sendBitfield();
+    // Pezzo appena completato; ignorato finche' l'handshake non e' concluso,
+    // perche' il BITFIELD deve essere il primo messaggio
+    void sendHave(uint32_t index);
 
 private:
     std::string ip;
     uint16_t port;
     int sockfd;
-    
+    State state = State::CONNECTING;
+    std::string expected_hash;
+
     bool peer_choking = true;
-    bool peer_interested = false; 
+    bool peer_interested = false;
     bool am_choking = true;
     bool am_interested = false;
 
+    // Ingresso: header e messaggi brevi passano dal ring, il corpo dei PIECE
+    // viene letto direttamente nel buffer del pezzo riservato al PieceManager.
+    RingBuffer in_ring;
+    BTMessage in_msg;
+
+    struct IncomingBlock {
+        bool active = false;
+        bool is_piece = false;  // false: messaggio troppo grande, viene scartato
+        uint32_t index = 0;
+        uint32_t begin = 0;
+        uint32_t length = 0;
+        uint32_t filled = 0;
+        uint8_t* dest = nullptr; // nullptr: i byte vengono solo consumati
+    } block;
+    std::vector<uint8_t> out_buffer;
+    size_t out_offset = 0;
+
+    // Uscita dei PIECE: l'header passa da send, il corpo va dai file al socket
+    // con sendfile. Un blocco iniziato precede i messaggi accodati nel frattempo.
+    struct OutgoingBlock {
+        bool active = false;
+        uint8_t header[13];
+        size_t header_sent = 0;
+        uint32_t index = 0;
+        uint32_t begin = 0;
+        uint32_t length = 0;
+        uint32_t sent = 0;
+    } upload;
+    std::deque<PieceManager::BlockRequest> upload_queue;
+
+    std::chrono::steady_clock::time_point state_since;
+    std::chrono::steady_clock::time_point last_recv;
+
+    bool receiveHandshake();
+    bool processInput();
+    void startBlock(uint32_t index, uint32_t begin, uint32_t length);
+    void finishBlock();
+    bool flush();
+    void queueSend(const void* data, size_t len);
+
     void handleMessage(const BTMessage& msg);
-    
+
     void sendInterested();
     bool am_Interested();
-    bool readAll(void* buf, size_t len);
-    
-    std::vector<uint8_t> peer_bitfield;
+    void sendUnchoke();
+    void sendChoke();
+    // REQUEST valido solo per un pezzo che abbiamo e dentro i suoi limiti
+    void queueUpload(uint32_t index, uint32_t begin, uint32_t length);
+    void startUpload();
+
+    // Mantiene piena la coda di richieste con i blocchi assegnati dal PieceManager
+    void fillPipeline();
+
+    // Bitfield del peer a parole da 64 bit, stesso layout di Bitfield: i byte
+    // restano nell'ordine del messaggio BITFIELD
+    std::vector<uint64_t> peer_bitfield;
+    size_t peer_piece_count = 0;
+
+    uint8_t* peerBytes() { return reinterpret_cast<uint8_t*>(peer_bitfield.data()); }
+
+    uint32_t peer_id;
+
+    struct PendingRequest {
+        PieceManager::BlockRequest req;
+        std::chrono::steady_clock::time_point sent;
+    };
+    std::vector<PendingRequest> pending_requests;
+
+    // Profondita' della coda = banda stimata x RTT minimo, con margine.
+    // L'RTT minimo esclude l'attesa dietro le nostre stesse richieste.
+    size_t pipeline_depth = 16;
+    double download_rate = 0;   // byte/s, media mobile
+    uint64_t window_bytes = 0;
+    std::chrono::steady_clock::time_point window_start;
+    std::chrono::steady_clock::duration min_rtt = std::chrono::steady_clock::duration::zero();
+    std::chrono::steady_clock::time_point min_rtt_since;
+
+    // Stessa media mobile per i byte inviati, che decide i giri del choker in seed mode
+    double upload_rate = 0;
+    uint64_t upload_window_bytes = 0;
+    std::chrono::steady_clock::time_point upload_window_start;
+
+    void onBlockReceived(size_t bytes, std::chrono::steady_clock::time_point sent);
+    void updatePipelineDepth(std::chrono::steady_clock::time_point now);
+    void updateUploadRate(std::chrono::steady_clock::time_point now);
 
     PieceManager* piece_manager;
-    std::vector<uint8_t>* global_bitfield;
-    std::shared_mutex* bitfield_mutex;
+    const Bitfield* global_bitfield;
 
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,69 @@
+#ifndef RINGBUFFER_HPP
+#define RINGBUFFER_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <sys/uio.h>
+
+// Buffer circolare di ricezione: capacita' potenza di due, i byte liberi
+// sono esposti come al massimo due iovec per leggere con readv senza copie
+// intermedie.
+class RingBuffer {
+public:
+    RingBuffer() = default;
+
+    void reset(size_t minCapacity) {
+        size_t cap = 1;
+        while (cap < minCapacity) cap <<= 1;
+        buf.assign(cap, 0);
+        mask = cap - 1;
+        head = tail = 0;
+    }
+
+    size_t size() const { return tail - head; }
+    size_t capacity() const { return buf.size(); }
+    size_t space() const { return capacity() - size(); }
+
+    // Segmenti liberi per al massimo maxBytes byte; restituisce quanti iovec sono validi
+    int writable(struct iovec* iov, size_t maxBytes) {
+        size_t n = std::min(maxBytes, space());
+        if (n == 0) return 0;
+
+        size_t start = tail & mask;
+        size_t first = std::min(n, capacity() - start);
+        iov[0].iov_base = buf.data() + start;
+        iov[0].iov_len = first;
+        if (first == n) return 1;
+
+        iov[1].iov_base = buf.data();
+        iov[1].iov_len = n - first;
+        return 2;
+    }
+
+    void produce(size_t n) { tail += n; }
+
+    void peek(void* dst, size_t n, size_t offset = 0) const {
+        size_t start = (head + offset) & mask;
+        size_t first = std::min(n, capacity() - start);
+        std::memcpy(dst, buf.data() + start, first);
+        if (first < n) std::memcpy(static_cast<uint8_t*>(dst) + first, buf.data(), n - first);
+    }
+
+    uint8_t at(size_t offset) const { return buf[(head + offset) & mask]; }
+
+    void consume(size_t n) {
+        head += n;
+        if (head == tail) head = tail = 0;
+    }
+
+private:
+    std::vector<uint8_t> buf;
+    size_t mask = 0;
+    uint64_t head = 0;
+    uint64_t tail = 0;
+};
+
+#endif
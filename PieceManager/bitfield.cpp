@@ -0,0 +1,166 @@
+#include "bitfield.hpp"
+#include <immintrin.h>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// ---- portabile --------------------------------------------------------------
+
+size_t count_andnot_scalar(const uint64_t* a, const uint64_t* b, size_t words) {
+    size_t n = 0;
+    for (size_t i = 0; i < words; ++i) n += __builtin_popcountll(a[i] & ~b[i]);
+    return n;
+}
+
+bool any_andnot_scalar(const uint64_t* a, const uint64_t* b, size_t words) {
+    for (size_t i = 0; i < words; ++i) {
+        if (a[i] & ~b[i]) return true;
+    }
+    return false;
+}
+
+size_t count_scalar(const uint64_t* a, size_t words) {
+    size_t n = 0;
+    for (size_t i = 0; i < words; ++i) n += __builtin_popcountll(a[i]);
+    return n;
+}
+
+// ---- POPCNT hardware ----------------------------------------------------------
+
+__attribute__((target("popcnt")))
+size_t count_andnot_popcnt(const uint64_t* a, const uint64_t* b, size_t words) {
+    size_t n = 0;
+    for (size_t i = 0; i < words; ++i) n += __builtin_popcountll(a[i] & ~b[i]);
+    return n;
+}
+
+__attribute__((target("popcnt")))
+size_t count_popcnt(const uint64_t* a, size_t words) {
+    size_t n = 0;
+    for (size_t i = 0; i < words; ++i) n += __builtin_popcountll(a[i]);
+    return n;
+}
+
+// ---- AVX2: 256 bit per iterazione, popcount a nibble con vpshufb -------------
+
+__attribute__((target("avx2")))
+inline __m256i popcount_bytes(__m256i v) {
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, low);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low);
+    return _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo), _mm256_shuffle_epi8(lut, hi));
+}
+
+__attribute__((target("avx2")))
+inline size_t horizontal_sum(__m256i acc) {
+    return (size_t)_mm256_extract_epi64(acc, 0) + (size_t)_mm256_extract_epi64(acc, 1) +
+           (size_t)_mm256_extract_epi64(acc, 2) + (size_t)_mm256_extract_epi64(acc, 3);
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t count_andnot_avx2(const uint64_t* a, const uint64_t* b, size_t words) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= words; i += 4) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i cnt = popcount_bytes(_mm256_andnot_si256(vb, va));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+    }
+    size_t n = horizontal_sum(acc);
+    for (; i < words; ++i) n += __builtin_popcountll(a[i] & ~b[i]);
+    return n;
+}
+
+__attribute__((target("avx2")))
+bool any_andnot_avx2(const uint64_t* a, const uint64_t* b, size_t words) {
+    size_t i = 0;
+    for (; i + 4 <= words; i += 4) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        // testc(b, a) = ((~b & a) == 0)
+        if (!_mm256_testc_si256(vb, va)) return true;
+    }
+    for (; i < words; ++i) {
+        if (a[i] & ~b[i]) return true;
+    }
+    return false;
+}
+
+__attribute__((target("avx2,popcnt")))
+size_t count_avx2(const uint64_t* a, size_t words) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= words; i += 4) {
+        __m256i cnt = popcount_bytes(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+    }
+    size_t n = horizontal_sum(acc);
+    for (; i < words; ++i) n += __builtin_popcountll(a[i]);
+    return n;
+}
+
+// ---- selezione ----------------------------------------------------------------
+
+struct Backend {
+    const char* name;
+    size_t (*count_andnot)(const uint64_t*, const uint64_t*, size_t);
+    bool (*any_andnot)(const uint64_t*, const uint64_t*, size_t);
+    size_t (*count)(const uint64_t*, size_t);
+};
+
+// In ordine di preferenza
+const Backend backends[] = {
+    { "avx2",   count_andnot_avx2,   any_andnot_avx2,   count_avx2   },
+    { "popcnt", count_andnot_popcnt, any_andnot_scalar, count_popcnt },
+    { "scalar", count_andnot_scalar, any_andnot_scalar, count_scalar },
+};
+
+bool cpu_has(const char* name) {
+    __builtin_cpu_init();
+    if (std::strcmp(name, "avx2") == 0) return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    if (std::strcmp(name, "popcnt") == 0) return __builtin_cpu_supports("popcnt");
+    return std::strcmp(name, "scalar") == 0;
+}
+
+// Inizializzato staticamente alla versione portabile: valido anche prima della selezione
+const Backend* current = &backends[2];
+
+// TORRENT_BITFIELD_BACKEND forza un backend (benchmark, confronto con il portabile)
+bool detect() {
+    const char* forced = std::getenv("TORRENT_BITFIELD_BACKEND");
+    for (const Backend& b : backends) {
+        if (forced && std::strcmp(forced, b.name) != 0) continue;
+        if (cpu_has(b.name)) {
+            current = &b;
+            return true;
+        }
+    }
+    return true;
+}
+
+const bool detected_at_startup = detect();
+
+}
+
+namespace bitfield_ops {
+
+size_t count_andnot(const uint64_t* a, const uint64_t* b, size_t words) { return current->count_andnot(a, b, words); }
+bool any_andnot(const uint64_t* a, const uint64_t* b, size_t words) { return current->any_andnot(a, b, words); }
+size_t count(const uint64_t* a, size_t words) { return current->count(a, words); }
+const char* backend_name() { return current->name; }
+
+bool select_backend(const char* name) {
+    for (const Backend& b : backends) {
+        if (std::strcmp(name, b.name) == 0 && cpu_has(b.name)) {
+            current = &b;
+            return true;
+        }
+    }
+    return false;
+}
+
+}
@@ -0,0 +1,124 @@
+#ifndef BITFIELD_HPP
+#define BITFIELD_HPP
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "Bitfield assume parole little-endian");
+
+// Kernel sulle parole da 64 bit, scelti all'avvio in base alla CPU (AVX2,
+// POPCNT, portabile) o forzati con TORRENT_BITFIELD_BACKEND. Gli operandi sono
+// bitfield nel formato del messaggio BITFIELD letti a parole di 8 byte: la
+// lunghezza e' in parole.
+namespace bitfield_ops {
+    // popcount(a & ~b): pezzi che il peer ha e noi no
+    size_t count_andnot(const uint64_t* a, const uint64_t* b, size_t words);
+    bool any_andnot(const uint64_t* a, const uint64_t* b, size_t words);
+    size_t count(const uint64_t* a, size_t words);
+
+    const char* backend_name();
+    // Forza un backend ("avx2", "popcnt", "scalar"); false se la CPU non lo supporta
+    bool select_backend(const char* name);
+}
+
+// Chiama fn(indice) per ogni bit acceso, una parola alla volta.
+// Dentro una parola l'ordine e' per byte crescente, non per indice.
+template <typename Fn>
+inline void forEachSetBit(const uint8_t* bytes, size_t numBits, Fn&& fn) {
+    size_t numBytes = (numBits + 7) / 8;
+    for (size_t off = 0; off < numBytes; off += 8) {
+        uint64_t w = 0;
+        std::memcpy(&w, bytes + off, std::min<size_t>(8, numBytes - off));
+        while (w) {
+            unsigned bit = __builtin_ctzll(w);
+            w &= w - 1;
+            size_t piece = (off + (bit >> 3)) * 8 + (7 - (bit & 7));
+            if (piece < numBits) fn((uint32_t)piece);
+        }
+    }
+}
+
+// Bitfield dei pezzi verificati, condiviso tra reactor, worker di hash e UI.
+// Parole atomiche da 64 bit che contengono i byte nell'ordine del messaggio
+// BITFIELD (il bit 7 del byte 0 e' il pezzo 0): un bitfield ricevuto da un
+// peer si confronta parola per parola senza conversioni. I lettori non
+// prendono lock e un bit, una volta acceso, non si spegne piu'.
+class Bitfield {
+public:
+    explicit Bitfield(size_t numBits)
+        : num_bits(numBits), num_words((numBits + 63) / 64), words(new std::atomic<uint64_t>[num_words])
+    {
+        for (size_t w = 0; w < num_words; ++w) words[w].store(0, std::memory_order_relaxed);
+    }
+
+    size_t size() const { return num_bits; }
+    size_t byteSize() const { return (num_bits + 7) / 8; }
+    size_t wordCount() const { return num_words; }
+
+    bool test(size_t i) const {
+        return (words[i >> 6].load(std::memory_order_acquire) & mask(i)) != 0;
+    }
+
+    // true se il bit era spento: solo un chiamante vince la transizione
+    bool set(size_t i) {
+        return (words[i >> 6].fetch_or(mask(i), std::memory_order_acq_rel) & mask(i)) == 0;
+    }
+
+    uint64_t word(size_t w) const { return words[w].load(std::memory_order_acquire); }
+
+    uint8_t byte(size_t b) const {
+        return (uint8_t)(word(b >> 3) >> (8 * (b & 7)));
+    }
+
+    // Vista in sola lettura per i kernel vettoriali: ogni parola e' letta
+    // intera, un bit acceso nel frattempo puo' esserci o no.
+    const uint64_t* raw() const {
+        static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "atomic<uint64_t> non compatto");
+        static_assert(std::atomic<uint64_t>::is_always_lock_free, "atomic<uint64_t> non lock-free");
+        return reinterpret_cast<const uint64_t*>(words.get());
+    }
+
+    size_t count() const { return bitfield_ops::count(raw(), num_words); }
+
+    // Formato del messaggio BITFIELD, byteSize() byte
+    void toBytes(std::vector<uint8_t>& out) const {
+        out.resize(byteSize());
+        for (size_t w = 0; w < num_words; ++w) {
+            uint64_t v = word(w);
+            size_t off = w * 8;
+            std::memcpy(out.data() + off, &v, std::min<size_t>(8, out.size() - off));
+        }
+    }
+
+    void fromBytes(const uint8_t* data, size_t len) {
+        len = std::min(len, byteSize());
+        for (size_t w = 0; w < num_words; ++w) {
+            uint64_t v = 0;
+            size_t off = w * 8;
+            if (off < len) std::memcpy(&v, data + off, std::min<size_t>(8, len - off));
+            words[w].store(v & validMask(w), std::memory_order_release);
+        }
+    }
+
+    // Bit validi della parola w: quelli oltre l'ultimo pezzo restano spenti
+    uint64_t validMask(size_t w) const {
+        if (w + 1 < num_words || (num_bits & 63) == 0) return ~0ULL;
+        uint64_t m = 0;
+        for (size_t i = w * 64; i < num_bits; ++i) m |= mask(i);
+        return m;
+    }
+
+private:
+    static uint64_t mask(size_t i) { return 1ULL << (((i >> 3) & 7) * 8 + 7 - (i & 7)); }
+
+    size_t num_bits;
+    size_t num_words;
+    std::unique_ptr<std::atomic<uint64_t>[]> words;
+};
+
+#endif
@@ -0,0 +1,59 @@
+#include "bufferPool.hpp"
+#include <sys/mman.h>
+#include <stdexcept>
+
+BufferPool::BufferPool(size_t slotSize, size_t numSlots, bool hugePages) : num_slots(numSlots) {
+    const size_t PAGE = 4096;
+    const size_t HUGE_PAGE = 2 * 1024 * 1024;
+
+    if (num_slots == 0) num_slots = 1;
+
+    if (hugePages) {
+        stride = (slotSize + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+        mapped_bytes = stride * num_slots;
+        void* p = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            base = static_cast<uint8_t*>(p);
+            huge = true;
+        }
+    }
+
+    if (!base) {
+        stride = (slotSize + PAGE - 1) / PAGE * PAGE;
+        mapped_bytes = stride * num_slots;
+        void* p = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            throw std::runtime_error("Impossibile allocare il pool dei buffer dei pezzi");
+        }
+        base = static_cast<uint8_t*>(p);
+#ifdef MADV_HUGEPAGE
+        if (hugePages) huge = madvise(base, mapped_bytes, MADV_HUGEPAGE) == 0;
+#endif
+    }
+
+    // Gli slot bassi escono per primi: le pagine gia' toccate vengono riusate
+    free_slots.reserve(num_slots);
+    for (size_t i = num_slots; i-- > 0;) free_slots.push_back((int)i);
+}
+
+BufferPool::~BufferPool() {
+    if (base) munmap(base, mapped_bytes);
+}
+
+int BufferPool::acquire() {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (free_slots.empty()) return -1;
+    int slot = free_slots.back();
+    free_slots.pop_back();
+    return slot;
+}
+
+void BufferPool::release(int slot) {
+    std::lock_guard<std::mutex> lock(mtx);
+    free_slots.push_back(slot);
+}
+
+size_t BufferPool::available() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return free_slots.size();
+}
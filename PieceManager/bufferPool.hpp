@@ -0,0 +1,41 @@
+#ifndef BUFFERPOOL_HPP
+#define BUFFERPOOL_HPP
+
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+// Slab di buffer a dimensione fissa per i pezzi in ricostruzione: un'unica
+// regione mappata all'avvio e divisa in slot, cosi' avviare un pezzo non
+// alloca nulla e la memoria totale non supera mai il budget.
+class BufferPool {
+public:
+    // hugePages: prova MAP_HUGETLB, poi le transparent huge page, poi pagine normali
+    BufferPool(size_t slotSize, size_t numSlots, bool hugePages = false);
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // -1 se tutti gli slot sono in uso
+    int acquire();
+    void release(int slot);
+
+    uint8_t* data(int slot) const { return base + (size_t)slot * stride; }
+    size_t slotCount() const { return num_slots; }
+    size_t available() const;
+    bool usingHugePages() const { return huge; }
+
+private:
+    uint8_t* base = nullptr;
+    size_t stride;
+    size_t num_slots;
+    size_t mapped_bytes = 0;
+    bool huge = false;
+
+    mutable std::mutex mtx;
+    std::vector<int> free_slots;
+};
+
+#endif
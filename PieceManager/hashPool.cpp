@@ -0,0 +1,86 @@
+#include "hashPool.hpp"
+#include "../parser/sha1.hpp"
+#include <algorithm>
+
+HashPool::HashPool(size_t numWorkers, Callback onDone) : onDone(std::move(onDone)) {
+    if (numWorkers == 0) numWorkers = 1;
+    for (size_t i = 0; i < numWorkers; ++i) {
+        workers.emplace_back(&HashPool::workerLoop, this);
+    }
+}
+
+HashPool::~HashPool() {
+    stop();
+}
+
+void HashPool::submit(uint32_t index, const uint8_t* data, size_t len, const uint8_t* expected) {
+    Job job;
+    job.index = index;
+    job.data = data;
+    job.len = len;
+    std::memcpy(job.expected, expected, 20);
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        queue.push_back(std::move(job));
+    }
+    cv.notify_one();
+}
+
+size_t HashPool::pending() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return queue.size() + in_flight;
+}
+
+// Svuota la coda prima di terminare: un pezzo gia' scaricato non va perso
+void HashPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (stopping) return;
+        stopping = true;
+    }
+    cv.notify_all();
+    for (auto& t : workers) {
+        if (t.joinable()) t.join();
+    }
+}
+
+// Quando piu' pezzi sono in coda insieme un worker li prende in blocco e li
+// verifica con l'hash multi-buffer invece che uno alla volta.
+void HashPool::workerLoop() {
+    const size_t MAX_BATCH = 16;
+
+    while (true) {
+        std::vector<Job> batch;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+
+            size_t take = std::min(queue.size(), MAX_BATCH);
+            for (size_t i = 0; i < take; ++i) {
+                batch.push_back(std::move(queue.front()));
+                queue.pop_front();
+            }
+            in_flight += take;
+        }
+
+        std::vector<const uint8_t*> ptrs(batch.size());
+        std::vector<size_t> lens(batch.size());
+        std::vector<uint8_t> digests(batch.size() * 20);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            ptrs[i] = batch[i].data;
+            lens[i] = batch[i].len;
+        }
+        sha1_engine::hash_many(ptrs.data(), lens.data(), batch.size(), reinterpret_cast<uint8_t (*)[20]>(digests.data()));
+
+        for (size_t i = 0; i < batch.size(); ++i) {
+            bool ok = std::memcmp(&digests[i * 20], batch[i].expected, 20) == 0;
+            onDone(batch[i].index, ok, batch[i].data, batch[i].len);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            in_flight -= batch.size();
+        }
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef HASHPOOL_HPP
+#define HASHPOOL_HPP
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+#include <cstring>
+
+// Pool di worker che verifica lo SHA-1 dei pezzi completati fuori dal lock
+// del PieceManager. L'esito arriva tramite la callback, sul thread del worker.
+class HashPool {
+public:
+    using Callback = std::function<void(uint32_t index, bool ok, const uint8_t* data, size_t len)>;
+
+    HashPool(size_t numWorkers, Callback onDone);
+    ~HashPool();
+
+    // data resta di proprieta' del chiamante e deve restare valido fino alla callback
+    void submit(uint32_t index, const uint8_t* data, size_t len, const uint8_t* expected);
+    void stop();
+
+    size_t pending() const;
+
+private:
+    struct Job {
+        uint32_t index;
+        const uint8_t* data;
+        size_t len;
+        uint8_t expected[20];
+    };
+
+    void workerLoop();
+
+    Callback onDone;
+    std::vector<std::thread> workers;
+    std::deque<Job> queue;
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+    size_t in_flight = 0;
+    bool stopping = false;
+};
+
+#endif
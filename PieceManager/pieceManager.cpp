@@ -5,40 +5,120 @@
 #include <fstream>
 #include <iomanip>
 #include <filesystem>
+#include <sys/stat.h>
 
-PieceManager::PieceManager(size_t numPieces, uint32_t pLen, long long totalSize) 
-    : global_bitfield((numPieces + 7) / 8, 0), 
+static size_t budgetSlots(size_t numPieces, uint32_t pLen, size_t memoryBudget) {
+    size_t slots = pLen ? memoryBudget / pLen : 0;
+    return std::max<size_t>(2, std::min(slots, numPieces));
+}
+
+PieceManager::PieceManager(size_t numPieces, uint32_t pLen, long long totalSize, size_t hashWorkers,
+                           size_t memoryBudget, bool hugePages) 
+    : global_bitfield(numPieces), 
       piece_length(pLen), 
-      total_size(totalSize) 
+      total_size(totalSize),
+      num_pieces(numPieces),
+      picker(numPieces),
+      buffer_pool(pLen, budgetSlots(numPieces, pLen, memoryBudget), hugePages),
+      slots(buffer_pool.slotCount()),
+      piece_slot(new std::atomic<int32_t>[numPieces])
 {
-    
-}
+    for (size_t i = 0; i < numPieces; ++i) piece_slot[i].store(-1, std::memory_order_relaxed);
+
+    uint32_t maxBlocks = (pLen + 16383) / 16384;
+    for (size_t i = 0; i < slots.size(); ++i) {
+        slots[i].buffer = buffer_pool.data(i);
+        slots[i].block_state.resize(maxBlocks);
+        slots[i].block_owner.resize(maxBlocks);
+    }
+    active_slots.reserve(slots.size());
 
+    // Meta' del budget in coda al disco basta a tenere occupata la rete
+    max_write_backlog = std::max<size_t>(memoryBudget / 2, pLen);
 
-int PieceManager::countSetBits(uint8_t n) const {
-    int count = 0;
-    while (n > 0) {
-        n &= (n - 1);
-        count++;
+    hash_pool = std::make_unique<HashPool>(hashWorkers,
+        [this](uint32_t index, bool ok, const uint8_t* data, size_t len) { onPieceHashed(index, ok, data, len); });
+}
+
+PieceManager::~PieceManager() {
+    recheck_stop = true;
+    for (auto& t : recheck_threads) {
+        if (t.joinable()) t.join();
     }
-    return count;
+    // L'handler di layout chiama saveBitfield: non deve arrivare dopo la distruzione
+    if (storage) storage->stopPreallocation();
+
+    // Prima l'hash, che accoda scritture, poi il disco, che le svuota
+    hash_pool->stop();
+    if (disk_io) disk_io->stop();
+
+    // Ultimo gruppo con le scritture appena svuotate, poi tutto nell'istantanea
+    if (commit_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(commit_mutex);
+            commit_stop = true;
+        }
+        commit_cv.notify_all();
+        commit_thread.join();
+        _savePartials();
+        saveBitfield();
+    }
+}
+
+void PieceManager::setStorage(Storage* s) {
+    storage = s;
+    disk_io = std::make_unique<DiskIO>(*s, 2,
+        [this](uint32_t index, bool ok, const uint8_t*, size_t len) { onPieceWritten(index, ok, len); });
+
+    // prepare() e fallocate cambiano dimensioni e mtime: si riparte da li'
+    storage->setLayoutHandler([this] {
+        {
+            std::lock_guard<std::mutex> lock(save_mutex);
+            for (size_t f = 0; f < file_stamps.size(); ++f) _restamp(f);
+        }
+        saveBitfield();
+    });
 }
 
-long long PieceManager::getDownloadedBytes() const {
-    std::shared_lock<std::shared_mutex> lock(rw_mutex);
-    long long completedPieces = 0;
 
-    for (uint8_t byte : global_bitfield) {
-        completedPieces += countSetBits(byte);
+PieceManager::Stats PieceManager::getStats() const {
+    Stats s;
+    for (;;) {
+        uint32_t before = stats_seq.load(std::memory_order_acquire);
+        if (before & 1) continue;
+
+        s.verified = stat_verified.load(std::memory_order_relaxed);
+        s.in_flight = stat_in_flight.load(std::memory_order_relaxed);
+        s.wasted = stat_wasted.load(std::memory_order_relaxed);
+        s.transferred = stat_transferred.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (stats_seq.load(std::memory_order_relaxed) == before) return s;
     }
+}
 
-    long long downloaded = completedPieces * piece_length;
+void PieceManager::_addStats(long long verified, long long inFlight, long long wasted, long long transferred) {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    uint32_t seq = stats_seq.load(std::memory_order_relaxed);
+    stats_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
 
-    return std::min(downloaded, total_size);
+    // fetch_add e non load+store: _countBlock aggiorna gli stessi contatori senza lock
+    stat_verified.fetch_add(verified, std::memory_order_relaxed);
+    stat_in_flight.fetch_add(inFlight, std::memory_order_relaxed);
+    stat_wasted.fetch_add(wasted, std::memory_order_relaxed);
+    stat_transferred.fetch_add(transferred, std::memory_order_relaxed);
+
+    stats_seq.store(seq + 2, std::memory_order_release);
+}
+
+void PieceManager::_countBlock(long long inFlight, long long wasted, long long transferred) {
+    if (inFlight) stat_in_flight.fetch_add(inFlight, std::memory_order_relaxed);
+    if (wasted) stat_wasted.fetch_add(wasted, std::memory_order_relaxed);
+    stat_transferred.fetch_add(transferred, std::memory_order_relaxed);
 }
 
 long long PieceManager::getLeftBytes() const {
-    
     long long downloaded = getDownloadedBytes();
     
     if (downloaded >= total_size) return 0;
@@ -46,211 +126,735 @@ long long PieceManager::getLeftBytes() const {
 }
 
 bool PieceManager::isPieceNeeded(int byteIndex, uint8_t peerByte) const {
-    std::shared_lock<std::shared_mutex> lock(rw_mutex);
-    if (byteIndex >= (int)global_bitfield.size()) return false;
+    if (byteIndex >= (int)global_bitfield.byteSize()) return false;
     
-    return (peerByte & ~global_bitfield[byteIndex]) != 0;
+    return (peerByte & ~global_bitfield.byte(byteIndex)) != 0;
 }
 
 void PieceManager::markAsComplete(int pieceIndex) {
-    std::unique_lock<std::shared_mutex> lock(rw_mutex);
-    _markAsComplete(pieceIndex);
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    if (_markAsComplete(pieceIndex)) _addStats(getPieceLength(pieceIndex), 0, 0, 0);
 }
 
-void PieceManager::_markAsComplete(int pieceIndex) {
-    size_t byteIdx = pieceIndex / 8;
-    if (byteIdx < global_bitfield.size()) {
-        global_bitfield[byteIdx] |= (1 << (7 - (pieceIndex % 8)));
+// true solo alla prima verifica del pezzo
+bool PieceManager::_markAsComplete(int pieceIndex) {
+    if ((uint32_t)pieceIndex >= num_pieces) return false;
+    bool fresh = global_bitfield.set(pieceIndex);
+    picker.setHave(pieceIndex);
+    return fresh;
+}
+
+PieceManager::PieceProgress* PieceManager::_startPiece(uint32_t index) {
+    if (index >= num_pieces) return nullptr;
+
+    int slot = buffer_pool.acquire();
+    if (slot < 0) return nullptr;
+
+    PieceProgress& p = slots[slot];
+    {
+        std::lock_guard<std::mutex> lock(p.mtx);
+        p.active = true;
+        p.index = index;
+        p.length = getPieceLength(index);
+        p.num_blocks = (p.length + 16383) / 16384;
+        std::fill(p.block_state.begin(), p.block_state.begin() + p.num_blocks, BLOCK_MISSING);
+        std::fill(p.block_owner.begin(), p.block_owner.begin() + p.num_blocks, 0);
+        p.unassigned = p.num_blocks;
+        p.bytes_received = 0;
+        p.hashing = false;
+        p.extra_requests.clear();
     }
+
+    piece_slot[index].store(slot, std::memory_order_release);
+    active_slots.push_back(slot);
+    return &p;
 }
 
-int PieceManager::pickPiece(const std::vector<uint8_t>& peer_bf) {
-    std::shared_lock<std::shared_mutex> lock(rw_mutex);
+void PieceManager::_releasePiece(uint32_t index) {
+    int32_t slot = piece_slot[index].load(std::memory_order_relaxed);
+    if (slot < 0) return;
+
+    {
+        std::lock_guard<std::mutex> lock(slots[slot].mtx);
+        slots[slot].active = false;
+    }
+    piece_slot[index].store(-1, std::memory_order_release);
+    active_slots.erase(std::find(active_slots.begin(), active_slots.end(), (uint32_t)slot));
+    buffer_pool.release(slot);
+}
 
-    for (size_t i = 0; i < global_bitfield.size() && i < peer_bf.size(); ++i) {
-        uint8_t needed = peer_bf[i] & ~global_bitfield[i];
+PieceManager::PieceProgress* PieceManager::_lockPiece(uint32_t index, std::unique_lock<std::mutex>& lock) {
+    if (index >= num_pieces) return nullptr;
+    PieceProgress* p = _findPiece(index);
+    if (!p) return nullptr;
 
-        if (needed != 0) {
-            for (int bit = 7; bit >= 0; --bit) {
-                if (needed & (1 << bit)) {
-                    return (i * 8) + (7 - bit);
-                }
+    lock = std::unique_lock<std::mutex>(p->mtx);
+    // Lo slot potrebbe essere stato liberato e riassegnato nel frattempo
+    if (!p->active || p->index != index) {
+        lock.unlock();
+        return nullptr;
+    }
+    return p;
+}
+
+size_t PieceManager::_assignFrom(uint32_t index, PieceProgress& p, uint32_t peerId, size_t maxBlocks, std::vector<BlockRequest>& out) {
+    size_t added = 0;
+
+    for (uint32_t b = 0; b < p.num_blocks && added < maxBlocks && p.unassigned > 0; ++b) {
+        if (p.block_state[b] != BLOCK_MISSING || p.block_owner[b] != 0) continue;
+
+        uint32_t begin = b * 16384;
+        uint32_t length = std::min<uint32_t>(16384, p.length - begin);
+        p.block_owner[b] = peerId;
+        p.unassigned--;
+        out.push_back({index, begin, length});
+        added++;
+    }
+    return added;
+}
+
+size_t PieceManager::assignBlocks(uint32_t peerId, const uint8_t* peer_bf, size_t peerPieceCount, size_t maxBlocks, std::vector<BlockRequest>& out) {
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    size_t added = 0;
+
+    // Prima si completano i pezzi gia' avviati, cosi' i buffer parziali restano pochi
+    for (uint32_t slot : active_slots) {
+        if (added >= maxBlocks) break;
+        PieceProgress& p = slots[slot];
+        if (!(peer_bf[p.index / 8] & (1 << (7 - (p.index % 8))))) continue;
+
+        std::lock_guard<std::mutex> pieceLock(p.mtx);
+        if (p.hashing || p.unassigned == 0) continue;
+        added += _assignFrom(p.index, p, peerId, maxBlocks - added, out);
+    }
+
+    // Un pezzo nuovo solo se il budget di memoria ha ancora uno slot libero e il disco sta al passo
+    while (added < maxBlocks && buffer_pool.available() > 0 && !_writeBacklogged()) {
+        int next = picker.pick(peer_bf, peerPieceCount, [this](uint32_t index) {
+            return piece_slot[index].load(std::memory_order_relaxed) >= 0;
+        });
+        if (next == -1) break;
+
+        PieceProgress* p = _startPiece(next);
+        if (!p) break;
+        std::lock_guard<std::mutex> pieceLock(p->mtx);
+        added += _assignFrom(next, *p, peerId, maxBlocks - added, out);
+    }
+
+    // Finche' la riverifica e' in corso remaining() non conta i pezzi in attesa
+    if (added < maxBlocks && !endgame && !recheckRunning() && active_slots.size() >= picker.remaining()) {
+        // Tutti i pezzi mancanti sono avviati: resta da vedere se ogni blocco e' richiesto
+        bool all = std::none_of(active_slots.begin(), active_slots.end(), [this](uint32_t slot) {
+            std::lock_guard<std::mutex> pieceLock(slots[slot].mtx);
+            return !slots[slot].hashing && slots[slot].unassigned > 0;
+        });
+        if (all) endgame.store(true);
+    }
+
+    if (endgame && added < maxBlocks) {
+        added += _assignEndgame(peerId, peer_bf, maxBlocks - added, out);
+    }
+    return added;
+}
+
+size_t PieceManager::_assignEndgame(uint32_t peerId, const uint8_t* peer_bf, size_t maxBlocks, std::vector<BlockRequest>& out) {
+    size_t added = 0;
+
+    for (uint32_t slot : active_slots) {
+        PieceProgress& p = slots[slot];
+        uint32_t index = p.index;
+        if (!(peer_bf[index / 8] & (1 << (7 - (index % 8))))) continue;
+
+        std::lock_guard<std::mutex> pieceLock(p.mtx);
+        if (p.hashing) continue;
+
+        for (uint32_t b = 0; b < p.num_blocks && added < maxBlocks; ++b) {
+            if (p.block_state[b] != BLOCK_MISSING || p.block_owner[b] == peerId) continue;
+
+            bool already = std::any_of(p.extra_requests.begin(), p.extra_requests.end(), [b, peerId](const auto& r) {
+                return r.first == b && r.second == peerId;
+            });
+            if (already) continue;
+
+            if (p.block_owner[b] == 0) {
+                p.block_owner[b] = peerId;
+                p.unassigned--;
+            } else {
+                p.extra_requests.push_back({b, peerId});
             }
+            uint32_t begin = b * 16384;
+            out.push_back({index, begin, std::min<uint32_t>(16384, p.length - begin)});
+            added++;
         }
+        if (added >= maxBlocks) break;
     }
-    return -1; 
+    return added;
 }
 
-std::vector<uint8_t>& PieceManager::getBitfield() { 
-    return global_bitfield; 
+void PieceManager::releaseBlocks(uint32_t peerId) {
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    for (uint32_t slot : active_slots) {
+        PieceProgress& p = slots[slot];
+        std::lock_guard<std::mutex> pieceLock(p.mtx);
+        for (size_t b = 0; b < p.num_blocks; ++b) {
+            if (p.block_owner[b] == peerId) {
+                p.block_owner[b] = 0;
+                if (p.block_state[b] != BLOCK_RECEIVED) p.unassigned++;
+            }
+        }
+        p.extra_requests.erase(std::remove_if(p.extra_requests.begin(), p.extra_requests.end(),
+                                              [peerId](const auto& r) { return r.second == peerId; }),
+                               p.extra_requests.end());
+    }
 }
 
-std::shared_mutex& PieceManager::getMutex() { 
-    return rw_mutex; 
+void PieceManager::peerHave(uint32_t index) {
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    picker.incAvailability(index);
 }
 
-bool PieceManager::addBlock(uint32_t index, uint32_t begin, const uint8_t* blockData, size_t blockSize) {
-    std::unique_lock<std::shared_mutex> lock(rw_mutex); 
+void PieceManager::peerBitfield(const uint8_t* peer_bf) {
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    forEachSetBit(peer_bf, num_pieces, [this](uint32_t i) { picker.incAvailability(i); });
+}
 
-    
-    size_t byteIdx = index / 8;
-    if (byteIdx >= global_bitfield.size()) return false;
-    if (global_bitfield[byteIdx] & (1 << (7 - (index % 8)))) return false; 
+void PieceManager::peerDisconnected(const uint8_t* peer_bf) {
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    forEachSetBit(peer_bf, num_pieces, [this](uint32_t i) { picker.decAvailability(i); });
+}
+
+uint8_t* PieceManager::reserveBlock(uint32_t index, uint32_t begin, uint32_t length) {
+    if (index >= num_pieces || global_bitfield.test(index)) return nullptr;
+
+    std::unique_lock<std::mutex> pieceLock;
+    // Un blocco non richiesto di un pezzo mai avviato viene scartato: avviarlo
+    // qui aggirerebbe il limite della coda di scrittura e il recheck in corso
+    PieceProgress* pp = _lockPiece(index, pieceLock);
+    if (!pp || pp->hashing) return nullptr;
+
+    // Solo blocchi interi e allineati: la contabilita' e' per blocco
+    uint32_t blockIndex = begin / 16384;
+    if (begin % 16384 != 0 || blockIndex >= pp->num_blocks) return nullptr;
+    if (length != std::min<uint32_t>(16384, pp->length - begin)) return nullptr;
+    if (pp->block_state[blockIndex] != BLOCK_MISSING) return nullptr;
+
+    // Lo slot resta assegnato al pezzo finche' il blocco non e' confermato
+    pp->block_state[blockIndex] = BLOCK_WRITING;
+    return pp->buffer + begin;
+}
 
-    if (in_progress.find(index) == in_progress.end()) {
-        long long numPieces = (total_size + piece_length - 1) / piece_length;
-        if (index >= (uint32_t)numPieces) return false; 
+void PieceManager::abortBlock(uint32_t index, uint32_t begin) {
+    std::unique_lock<std::mutex> pieceLock;
+    PieceProgress* p = _lockPiece(index, pieceLock);
+    if (!p) return;
 
-        uint32_t current_p_len = piece_length;
-        if (index == (uint32_t)(numPieces - 1)) {
-            current_p_len = static_cast<uint32_t>(total_size - (index * (long long)piece_length));
+    uint32_t blockIndex = begin / 16384;
+    if (blockIndex < p->num_blocks && p->block_state[blockIndex] == BLOCK_WRITING) {
+        p->block_state[blockIndex] = BLOCK_MISSING;
+    }
+}
+
+bool PieceManager::commitBlock(uint32_t index, uint32_t begin, uint32_t length, uint32_t peerId) {
+    std::vector<std::pair<uint32_t, BlockRequest>> cancels;
+    bool complete = false;
+    bool unverifiable = false;
+    {
+        std::unique_lock<std::mutex> pieceLock;
+        PieceProgress* pp = _lockPiece(index, pieceLock);
+        if (!pp) return false;
+        PieceProgress& p = *pp;
+
+        uint32_t blockIndex = begin / 16384;
+        if (blockIndex >= p.num_blocks || p.block_state[blockIndex] != BLOCK_WRITING) {
+            _countBlock(0, length, length);
+            return false;
+        }
+
+        p.block_state[blockIndex] = BLOCK_RECEIVED;
+        uint32_t owner = p.block_owner[blockIndex];
+        if (owner == 0) p.unassigned--;
+        p.block_owner[blockIndex] = 0;
+        p.bytes_received += length;
+        _countBlock(length, 0, length);
+
+        if (endgame.load(std::memory_order_relaxed)) {
+            BlockRequest req{index, begin, length};
+            if (owner != 0 && owner != peerId) cancels.push_back({owner, req});
+
+            auto& extra = p.extra_requests;
+            for (size_t i = 0; i < extra.size();) {
+                if (extra[i].first == blockIndex) {
+                    if (extra[i].second != peerId) cancels.push_back({extra[i].second, req});
+                    extra[i] = extra.back();
+                    extra.pop_back();
+                } else {
+                    ++i;
+                }
+            }
+        }
+
+        if (p.bytes_received >= p.length) {
+            p.hashing = true;
+            if (!metainfo || index >= metainfo->num_pieces) {
+                unverifiable = true;
+                _addStats(0, -(long long)p.length, p.length, 0);
+            } else {
+                // La verifica avviene nel pool; lo slot torna libero solo dopo la scrittura su disco
+                hash_pool->submit(index, p.buffer, p.length, metainfo->pieceHash(index));
+                complete = true;
+            }
         }
-        
-        PieceProgress& new_p = in_progress[index];
-        new_p.buffer.resize(current_p_len);
-        new_p.bytes_received = 0;
-        uint32_t num_blocks = (current_p_len + 16383) / 16384;
-        new_p.blocks_received.assign(num_blocks, false);
     }
 
-    PieceProgress& p = in_progress[index];
+    if (unverifiable) {
+        std::lock_guard<std::mutex> lock(picker_mutex);
+        _releasePiece(index);
+    }
 
-    uint32_t realPieceLen = getPieceLength(index);
-    if (begin + blockSize > realPieceLen) {
-        
-        return false; 
+    // I CANCEL partono fuori dai lock: l'handler passa dal reactor degli altri peer
+    if (cancel_handler) {
+        for (const auto& [peer, req] : cancels) cancel_handler(peer, req);
     }
+    return complete;
+}
 
-    uint32_t blockIndex = begin / 16384;
+void PieceManager::onPieceHashed(uint32_t index, bool ok, const uint8_t* data, size_t len) {
+    // Il buffer resta nello slot finche' la scrittura non e' conclusa
+    if (ok && disk_io) {
+        disk_io->submit(index, data, len);
+        return;
+    }
+    onPieceWritten(index, ok && saveToDisk(index, data, len), len);
+}
 
-    if (blockIndex < p.blocks_received.size() && !p.blocks_received[blockIndex]) {
-        if (begin + blockSize <= p.buffer.size()) {
-            std::copy(blockData, blockData + blockSize, p.buffer.begin() + begin);
-            p.blocks_received[blockIndex] = true;
-            p.bytes_received += blockSize;
-            total_transferred += blockSize; 
-        }
+// Un pezzo che non arriva su disco va riscaricato come uno con hash errato
+void PieceManager::onPieceWritten(uint32_t index, bool saved, size_t len) {
+    bool fresh;
+    {
+        std::lock_guard<std::mutex> lock(picker_mutex);
+        fresh = saved && _markAsComplete(index);
+        // Un solo aggiornamento: i byte passano da in_flight a verified (o wasted) in modo atomico
+        _addStats(fresh ? (long long)len : 0, -(long long)len, saved ? 0 : (long long)len, 0);
+        _releasePiece(index);
+    }
+
+    if (fresh) {
+        _queueCommit(index);
+        _announceHave(index);
+    }
+}
+
+bool PieceManager::saveToDisk(uint32_t index, const uint8_t* data, size_t len) {
+    if (!storage) return false;
+    return storage->writePiece(index, data, len);
+}
+
+void PieceManager::setHaveHandler(HaveHandler handler) {
+    std::lock_guard<std::mutex> lock(have_mutex);
+    have_handler = std::move(handler);
+}
+
+void PieceManager::_announceHave(uint32_t index) {
+    std::lock_guard<std::mutex> lock(have_mutex);
+    if (have_handler) have_handler(index);
+}
+
+ssize_t PieceManager::sendBlock(int sockfd, uint32_t index, uint32_t begin, size_t len) {
+    if (!storage) {
+        errno = EIO;
+        return -1;
+    }
+    return storage->sendTo(sockfd, (long long)index * piece_length + begin, len);
+}
+
+static long long stampNanos(const struct timespec& ts) {
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void PieceManager::_restamp(size_t file) {
+    if (file >= file_stamps.size()) return;
+    struct stat st;
+    if (stat(metainfo->files[file].path.c_str(), &st) == 0) {
+        file_stamps[file] = {(long long)st.st_size, stampNanos(st.st_mtim)};
     } else {
-        return false; 
-    }
-
-    if (p.bytes_received >= p.buffer.size()) {
-        sha1 hasher;
-        hasher.add(p.buffer.data(), p.buffer.size());
-        hasher.finalize();
-        
-        char calculated_hex[41];
-        hasher.print_hex(calculated_hex);
-        
-        std::string calc_str(calculated_hex, 40);
-
-        
-        if ((index * 20) + 20 > pieces_hashes.length()) {
-            in_progress.erase(index);
-            return false;
+        file_stamps[file] = FileStamp();
+    }
+}
+
+std::vector<FileStamp> PieceManager::_savedStamps() const {
+    // Un file non ancora riverificato viene salvato senza mtime: al prossimo
+    // avvio non risultera' invariato
+    std::vector<FileStamp> stamps = file_stamps;
+    for (size_t f = 0; f < stamps.size(); ++f) {
+        if (file_stale[f]) stamps[f].mtime = -1;
+    }
+    return stamps;
+}
+
+void PieceManager::setStateFile(const std::string& infoHashHex) {
+    std::filesystem::create_directories("resume_data");
+    this->state_filename = "resume_data/" + infoHashHex;
+    journal = std::make_unique<ResumeJournal>(state_filename);
+    commit_thread = std::thread(&PieceManager::_commitLoop, this);
+}
+
+void PieceManager::saveBitfield() {
+    std::lock_guard<std::mutex> lock(save_mutex);
+    if (!journal) return;
+    journal->compact(committed, _savedStamps(), partials);
+}
+
+void PieceManager::_queueCommit(uint32_t index) {
+    if (!journal) return;
+    bool full;
+    {
+        std::lock_guard<std::mutex> lock(commit_mutex);
+        pending_commits.push_back(index);
+        full = pending_commits.size() >= COMMIT_PIECES;
+    }
+    if (full) commit_cv.notify_one();
+}
+
+void PieceManager::_commitLoop() {
+    std::unique_lock<std::mutex> lock(commit_mutex);
+    while (true) {
+        commit_cv.wait_for(lock, COMMIT_INTERVAL, [this] { return commit_stop || pending_commits.size() >= COMMIT_PIECES; });
+        if (pending_commits.empty()) {
+            if (commit_stop) break;
+            continue;
         }
 
-        std::string expected_bin = pieces_hashes.substr(index * 20, 20);
-        std::stringstream ss;
-        for(unsigned char c : expected_bin) ss << std::hex << std::setw(2) << std::setfill('0') << (int)c;
-        std::string expected_hex = ss.str();
-
-        if (calc_str == expected_hex) {
-            std::vector<uint8_t> completedData = std::move(p.buffer);
-            in_progress.erase(index);
-            lock.unlock();
-
-            saveToDisk(index, completedData);
-            
-            {
-            std::unique_lock<std::shared_mutex> finalLock(rw_mutex);
-                _markAsComplete(index);
+        std::vector<uint32_t> batch;
+        batch.swap(pending_commits);
+        lock.unlock();
+        bool ok = _commit(batch);
+        lock.lock();
+        // Dati non sincronizzati: i pezzi riprovano al giro successivo
+        if (!ok && !commit_stop) pending_commits.insert(pending_commits.end(), batch.begin(), batch.end());
+    }
+}
+
+bool PieceManager::_commit(const std::vector<uint32_t>& pieces) {
+    // Prima i dati: un pezzo nel journal deve essere gia' su disco
+    if (storage && !storage->flush()) return false;
+
+    std::lock_guard<std::mutex> lock(save_mutex);
+    std::vector<uint8_t> touched(file_stamps.size(), 0);
+    for (uint32_t index : pieces) {
+        metainfo->forEachPieceSpan(index, [&](size_t f, long long, size_t, size_t) { touched[f] = 1; });
+    }
+
+    // La scrittura ha cambiato mtime dei file del gruppo
+    std::vector<std::pair<uint32_t, FileStamp>> stamps;
+    for (size_t f = 0; f < touched.size(); ++f) {
+        if (!touched[f]) continue;
+        _restamp(f);
+        FileStamp s = file_stamps[f];
+        if (file_stale[f]) s.mtime = -1;
+        stamps.emplace_back(f, s);
+    }
+    if (!journal->commit(pieces, stamps)) return false;
+    for (uint32_t index : pieces) committed[index / 8] |= 0x80 >> (index % 8);
+
+    // Il journal cresce con i pezzi: oltre la dimensione dell'istantanea conviene riscriverla
+    size_t snapshotBytes = committed.size() + file_stamps.size() * sizeof(FileStamp);
+    if (journal->journalBytes() >= std::max(JOURNAL_COMPACT_BYTES, snapshotBytes)) {
+        journal->compact(committed, _savedStamps(), partials);
+    }
+    return true;
+}
+
+void PieceManager::_savePartials() {
+    if (!storage || !journal || !metainfo) return;
+
+    // Hash e disco sono fermi: gli slot ancora attivi aspettano solo blocchi dalla rete
+    std::vector<PartialPiece> saved;
+    std::vector<uint8_t> touched(metainfo->files.size(), 0);
+    {
+        std::lock_guard<std::mutex> lock(picker_mutex);
+        for (uint32_t slot : active_slots) {
+            PieceProgress& p = slots[slot];
+            std::lock_guard<std::mutex> pieceLock(p.mtx);
+            if (p.hashing || p.bytes_received == 0) continue;
+
+            PartialPiece partial;
+            partial.index = p.index;
+            partial.blocks.assign((p.num_blocks + 7) / 8, 0);
+            long long pieceOffset = (long long)p.index * piece_length;
+            // Blocchi ricevuti consecutivi in una sola scrittura
+            for (uint32_t b = 0; b < p.num_blocks;) {
+                if (p.block_state[b] != BLOCK_RECEIVED) {
+                    ++b;
+                    continue;
+                }
+                uint32_t first = b;
+                while (b < p.num_blocks && p.block_state[b] == BLOCK_RECEIVED) ++b;
+                uint32_t begin = first * 16384;
+                uint32_t len = std::min<uint32_t>(b * 16384, p.length) - begin;
+                if (!storage->write(pieceOffset + begin, p.buffer + begin, len)) continue;
+                for (uint32_t k = first; k < b; ++k) partial.blocks[k / 8] |= 0x80 >> (k % 8);
+                metainfo->forEachFileSpan(pieceOffset + begin, len, [&](size_t f, long long, size_t, size_t) { touched[f] = 1; });
             }
+            saved.push_back(std::move(partial));
+        }
+    }
+    if (saved.empty()) return;
 
-            saveBitfield();
-            return true;
-        } else {
-            in_progress.erase(index);
-            return false;
+    // Come per i pezzi: prima i dati su disco, poi il registro che li cita
+    if (!storage->flush()) return;
+    std::lock_guard<std::mutex> lock(save_mutex);
+    for (size_t f = 0; f < touched.size(); ++f) {
+        if (touched[f]) _restamp(f);
+    }
+    partials = std::move(saved);
+    std::cout << "\n[Resume] Salvati " << partials.size() << " pezzi incompleti." << std::endl;
+}
+
+void PieceManager::restorePartials() {
+    std::vector<PartialPiece> pending;
+    {
+        std::lock_guard<std::mutex> lock(save_mutex);
+        pending.swap(partials);
+    }
+    if (!storage || pending.empty()) return;
+
+    // All'avvio nessun peer e' collegato: le letture sotto picker_mutex non bloccano nessuno
+    size_t restored = 0;
+    long long restoredBytes = 0;
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    for (const PartialPiece& partial : pending) {
+        if (global_bitfield.test(partial.index) || piece_slot[partial.index].load(std::memory_order_relaxed) >= 0) continue;
+        PieceProgress* pp = _startPiece(partial.index);
+        if (!pp) break;
+
+        bool complete = false;
+        {
+            std::lock_guard<std::mutex> pieceLock(pp->mtx);
+            PieceProgress& p = *pp;
+            long long pieceOffset = (long long)p.index * piece_length;
+            for (uint32_t b = 0; b < p.num_blocks; ++b) {
+                if (!(partial.blocks[b / 8] & (0x80 >> (b % 8)))) continue;
+                uint32_t begin = b * 16384;
+                uint32_t len = std::min<uint32_t>(16384, p.length - begin);
+                if (!storage->read(pieceOffset + begin, p.buffer + begin, len)) continue;
+                p.block_state[b] = BLOCK_RECEIVED;
+                p.unassigned--;
+                p.bytes_received += len;
+            }
+            // I byte ripresi contano come ricevuti e non verificati, come quelli dalla rete
+            _addStats(0, p.bytes_received, 0, 0);
+            restoredBytes += p.bytes_received;
+            if (p.bytes_received >= p.length) {
+                p.hashing = true;
+                hash_pool->submit(p.index, p.buffer, p.length, metainfo->pieceHash(p.index));
+                complete = true;
+            }
         }
+        if (pp->bytes_received == 0 && !complete) {
+            _releasePiece(partial.index);
+            continue;
+        }
+        restored++;
+    }
+
+    if (restored > 0) {
+        std::cout << "[Resume] Ripresi " << restored << " pezzi incompleti ("
+                  << restoredBytes / 1024 << " KB gia' ricevuti)." << std::endl;
     }
-    return false;
 }
 
-void PieceManager::saveToDisk(uint32_t index, const std::vector<uint8_t>& data) {
-    long long pieceGlobalOffset = (long long)index * piece_length;
-    long long currentFileStart = 0;
-    size_t dataOffset = 0;
-    long long bytesRemaining = data.size();
+void PieceManager::loadBitfield() {
+    if (!journal || !metainfo) return;
 
-    for (const auto& file : filesList) {
-        long long currentFileEnd = currentFileStart + file.length;
-        if (pieceGlobalOffset < currentFileEnd && (pieceGlobalOffset + bytesRemaining) > currentFileStart) {
-            long long writeOffset = std::max(0LL, pieceGlobalOffset - currentFileStart);
-            long long bytesToWrite = std::min(bytesRemaining, file.length - writeOffset);
+    const std::vector<FileInfo>& files = metainfo->files;
+    std::vector<FileStamp> current(files.size());
+    for (size_t f = 0; f < files.size(); ++f) {
+        struct stat st;
+        if (stat(files[f].path.c_str(), &st) == 0) current[f] = {(long long)st.st_size, stampNanos(st.st_mtim)};
+    }
 
-            std::filesystem::path p(file.path);
-            if (p.has_parent_path()) std::filesystem::create_directories(p.parent_path());
+    std::vector<FileStamp> saved;
+    std::vector<uint8_t> stored;
+    {
+        std::lock_guard<std::mutex> lock(save_mutex);
+        if (!journal->load(num_pieces, files.size(), stored, saved, partials)) {
+            saved.clear();
+            stored.clear();
+        }
+    }
 
-            std::fstream fs(file.path, std::ios::in | std::ios::out | std::ios::binary);
-            if (!fs.is_open()) {
-                std::ofstream create(file.path, std::ios::binary);
-                create.seekp(file.length - 1);
-                create.write("\0", 1);
-                create.close();
-                fs.open(file.path, std::ios::in | std::ios::out | std::ios::binary);
-            }
-            fs.seekp(writeOffset);
-            fs.write(reinterpret_cast<const char*>(&data[dataOffset]), bytesToWrite);
-            fs.close();
+    std::vector<uint8_t> unchanged(files.size(), 0);
+    for (size_t f = 0; f < files.size() && !saved.empty(); ++f) {
+        unchanged[f] = current[f].size >= 0 && current[f].size == saved[f].size && current[f].mtime == saved[f].mtime;
+    }
 
-            dataOffset += bytesToWrite;
-            bytesRemaining -= bytesToWrite;
-            pieceGlobalOffset += bytesToWrite; 
+    // Un pezzo vale se e' nel registro e nessuno dei suoi file e' cambiato;
+    // altrimenti, se i file coprono gia' il suo intervallo, va riletto
+    std::vector<uint8_t> valid(global_bitfield.byteSize(), 0);
+    recheck_list.clear();
+    for (uint32_t i = 0; i < num_pieces; ++i) {
+        bool allUnchanged = true;
+        bool present = true;
+        metainfo->forEachPieceSpan(i, [&](size_t f, long long fileOffset, size_t, size_t n) {
+            if (!unchanged[f]) allUnchanged = false;
+            if (current[f].size < fileOffset + (long long)n) present = false;
+        });
+
+        if (allUnchanged) {
+            if (!stored.empty() && (stored[i / 8] & (0x80 >> (i % 8)))) valid[i / 8] |= 0x80 >> (i % 8);
+        } else if (present) {
+            recheck_list.push_back(i);
         }
-        currentFileStart += file.length;
-        if (bytesRemaining <= 0) break;
     }
+
+    {
+        std::lock_guard<std::mutex> lock(save_mutex);
+        // Un pezzo incompleto vale solo se i suoi file non sono cambiati dalla chiusura
+        partials.erase(std::remove_if(partials.begin(), partials.end(), [&](const PartialPiece& p) {
+            bool allUnchanged = true;
+            metainfo->forEachPieceSpan(p.index, [&](size_t f, long long, size_t, size_t) {
+                if (!unchanged[f]) allUnchanged = false;
+            });
+            uint32_t numBlocks = (getPieceLength(p.index) + 16383) / 16384;
+            return !allUnchanged || p.blocks.size() != (numBlocks + 7) / 8 || (valid[p.index / 8] & (0x80 >> (p.index % 8)));
+        }), partials.end());
+        committed = valid;
+        file_stamps = current;
+        file_stale.assign(files.size(), 0);
+        for (size_t f = 0; f < files.size(); ++f) file_stale[f] = !unchanged[f];
+    }
+
+    std::lock_guard<std::mutex> lock(picker_mutex);
+    global_bitfield.fromBytes(valid.data(), valid.size());
+    forEachSetBit(valid.data(), num_pieces, [this](uint32_t i) { picker.setHave(i); });
+    // Fuori dal picker fino al verdetto: potrebbero essere gia' su disco, e
+    // tenerli nei bucket costerebbe una scansione a ogni pick
+    for (uint32_t i : recheck_list) picker.setHave(i);
+
+    // Solo l'ultimo pezzo puo' essere piu' corto
+    long long verified = (long long)global_bitfield.count() * piece_length;
+    if (num_pieces > 0 && global_bitfield.test(num_pieces - 1)) verified -= piece_length - getPieceLength(num_pieces - 1);
+    _addStats(verified - stat_verified.load(std::memory_order_relaxed), 0, 0, 0);
+
+    if (verified > 0) std::cout << "[Resume] Stato caricato correttamente dal registro." << std::endl;
+    if (!recheck_list.empty()) std::cout << "[Resume] " << recheck_list.size() << " pezzi da verificare su disco." << std::endl;
 }
 
-void PieceManager::saveBitfield() {
-    if (state_filename.empty()) return;
-    
-    std::shared_lock<std::shared_mutex> lock(rw_mutex);
-    std::ofstream ofs(state_filename, std::ios::binary);
-    if (ofs.is_open()) {
-        
-        //std::cout << "\n[DEBUG] Salvataggio bitfield in: " << std::filesystem::absolute(state_filename) << std::endl;
-        
-        ofs.write(reinterpret_cast<const char*>(global_bitfield.data()), global_bitfield.size());
-        ofs.close();
-    } else {
-        std::cerr << "\n[ERRORE] Impossibile creare il file: " << state_filename << " (Errore: " << strerror(errno) << ")" << std::endl;
+void PieceManager::startRecheck(size_t threads) {
+    if (!storage || recheck_list.empty()) {
+        std::lock_guard<std::mutex> lock(save_mutex);
+        std::fill(file_stale.begin(), file_stale.end(), 0);
+        return;
+    }
+
+    // I buffer sono slot del pool dei pezzi, come per i download: la verifica
+    // resta nel budget di memoria e ne prende al massimo meta', perche' i peer
+    // si collegano mentre e' ancora in corso. Sedici pezzi per thread riempiono
+    // le corsie di hash_many, che con meno buffer e' piu' lento dell'hash di
+    // un pezzo alla volta
+    size_t spare = buffer_pool.available() / 2;
+    threads = std::max<size_t>(1, std::min({threads, RECHECK_MAX_THREADS, spare}));
+    uint32_t maxPieces = std::clamp<size_t>(spare / threads, 1, RECHECK_MAX_PIECES);
+
+    // Pezzi consecutivi letti insieme: ogni thread legge a blocchi sequenziali
+    // e i thread si distribuiscono i blocchi man mano
+    for (uint32_t index : recheck_list) {
+        if (!recheck_chunks.empty()) {
+            RecheckChunk& last = recheck_chunks.back();
+            if (last.first + last.count == index && last.count < maxPieces) {
+                last.count++;
+                continue;
+            }
+        }
+        recheck_chunks.push_back({index, 1});
+    }
+
+    threads = std::min(threads, recheck_chunks.size());
+    recheck_start = std::chrono::steady_clock::now();
+    recheck_running = threads;
+    for (size_t i = 0; i < threads; ++i) {
+        std::vector<int> buffers;
+        for (uint32_t k = 0; k < maxPieces; ++k) {
+            int slot = buffer_pool.acquire();
+            if (slot < 0) break;
+            buffers.push_back(slot);
+        }
+        recheck_threads.emplace_back(&PieceManager::_recheckLoop, this, std::move(buffers));
     }
 }
 
-void PieceManager::loadBitfield() {
-    if (state_filename.empty()) return;
-
-    std::ifstream ifs(state_filename, std::ios::binary);
-    if (ifs.is_open()) {
-        
-        ifs.seekg(0, std::ios::end);
-        size_t fileSize = ifs.tellg();
-        ifs.seekg(0, std::ios::beg);
-
-        if (fileSize == global_bitfield.size()) {
-            std::unique_lock<std::shared_mutex> lock(rw_mutex);
-            ifs.read(reinterpret_cast<char*>(global_bitfield.data()), global_bitfield.size());
-            std::cout << "[Resume] Stato caricato correttamente dal registro." << std::endl;
+void PieceManager::_recheckLoop(std::vector<int> buffers) {
+    // Pool esaurito dai pezzi ripresi: un pezzo alla volta in un buffer proprio
+    std::vector<uint8_t> own;
+    std::vector<uint8_t*> bufs;
+    for (int slot : buffers) bufs.push_back(buffer_pool.data(slot));
+    if (bufs.empty()) {
+        own.resize(piece_length);
+        bufs.push_back(own.data());
+    }
+
+    size_t cur;
+    while ((cur = recheck_next.fetch_add(1)) < recheck_chunks.size() && !recheck_stop) {
+        const RecheckChunk& c = recheck_chunks[cur];
+        long long offset = (long long)c.first * piece_length;
+        size_t len = (size_t)(c.count - 1) * piece_length + getPieceLength(c.first + c.count - 1);
+        storage->adviseSequential(offset, len);
+
+        for (uint32_t base = 0; base < c.count; base += bufs.size()) {
+            uint32_t n = std::min<size_t>(bufs.size(), c.count - base);
+            const uint8_t* ptrs[RECHECK_MAX_PIECES];
+            size_t lens[RECHECK_MAX_PIECES];
+            uint8_t digests[RECHECK_MAX_PIECES][20];
+            bool readOk = true;
+            for (uint32_t k = 0; k < n && readOk; ++k) {
+                uint32_t index = c.first + base + k;
+                ptrs[k] = bufs[k];
+                lens[k] = getPieceLength(index);
+                readOk = storage->read((long long)index * piece_length, bufs[k], lens[k]);
+            }
+            if (readOk) sha1_engine::hash_many(ptrs, lens, n, digests);
+
+            for (uint32_t k = 0; k < n; ++k) {
+                uint32_t index = c.first + base + k;
+                bool ok = readOk && std::memcmp(digests[k], metainfo->pieceHash(index), 20) == 0;
+                bool fresh = false;
+                {
+                    std::lock_guard<std::mutex> lock(picker_mutex);
+                    fresh = ok && _markAsComplete(index);
+                    if (fresh) _addStats(getPieceLength(index), 0, 0, 0);
+                    else if (!ok) picker.unsetHave(index);
+                }
+                if (ok) {
+                    recheck_valid++;
+                    _queueCommit(index);
+                }
+                if (fresh) _announceHave(index);
+            }
         }
-        ifs.close();
+        recheck_bytes += len;
+    }
+
+    for (int slot : buffers) buffer_pool.release(slot);
+    if (recheck_running.fetch_sub(1) == 1 && !recheck_stop) _finishRecheck();
+}
+
+void PieceManager::_finishRecheck() {
+    std::chrono::duration<double> dt = std::chrono::steady_clock::now() - recheck_start;
+    double gb = recheck_bytes.load() / 1e9;
+    std::cout << "\n[Resume] Verifica completata: " << recheck_valid.load() << " pezzi validi su " << recheck_list.size()
+              << ", " << std::fixed << std::setprecision(2) << gb << " GB in " << dt.count() << " s ("
+              << gb / std::max(dt.count(), 1e-3) << " GB/s)" << std::endl;
+
+    {
+        std::lock_guard<std::mutex> lock(save_mutex);
+        std::fill(file_stale.begin(), file_stale.end(), 0);
     }
+    saveBitfield();
 }
 
 
 
-uint32_t PieceManager::getPieceLength(uint32_t index) {
+uint32_t PieceManager::getPieceLength(uint32_t index) const {
     long long numPieces = (total_size + piece_length - 1) / piece_length;
     
     if (index == numPieces - 1) {
@@ -2,32 +2,48 @@
 #define PIECEMANAGER_HPP
 
 #include <vector>
-#include <shared_mutex>
 #include <mutex>
 #include <cstdint>
-#include <map>
+#include <functional>
 #include <string>
 #include <fstream>
 #include <atomic>
 #include <filesystem>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
 #include "../parser/TorrentFile.hpp"
+#include "hashPool.hpp"
+#include "bufferPool.hpp"
+#include "piecePicker.hpp"
+#include "bitfield.hpp"
+#include "resumeJournal.hpp"
+#include "../Storage/storage.hpp"
+#include "../Storage/diskIO.hpp"
 
 
+// Stato condiviso da tutti i thread del reactor, diviso per lock:
+//  - global_bitfield: pezzi verificati, parole atomiche, letto senza lock;
+//  - picker_mutex: picker, assegnazione pezzo->slot e proprietari dei blocchi;
+//  - PieceProgress::mtx: stato dei blocchi di un singolo pezzo in ricostruzione.
+// Ordine di acquisizione: picker_mutex prima del lock di uno slot, mai il contrario.
 class PieceManager {
 public:
     
-    std::vector<uint8_t> global_bitfield;
-    mutable std::shared_mutex rw_mutex;
+    Bitfield global_bitfield;
     uint32_t piece_length;
     long long total_size; 
     std::string download_filename = "output_file.dat";
-    std::vector<FileInfo> filesList;
 
-    std::atomic<long long> total_transferred{0}; 
     std::string state_filename; 
 
     
-    PieceManager(size_t numPieces, uint32_t pLen, long long totalSize);
+    // memoryBudget limita i buffer dei pezzi in ricostruzione: finche' e' esaurito
+    // non vengono avviati pezzi nuovi
+    PieceManager(size_t numPieces, uint32_t pLen, long long totalSize, size_t hashWorkers = 2,
+                 size_t memoryBudget = 256ULL * 1024 * 1024, bool hugePages = false);
+    ~PieceManager();
 
     bool isPieceNeeded(int byteIndex, uint8_t peerByte) const;
 
@@ -35,48 +51,232 @@ public:
     void markAsComplete(int pieceIndex);
 
 
-    int pickPiece(const std::vector<uint8_t>& peer_bf);
+    struct BlockRequest {
+        uint32_t index;
+        uint32_t begin;
+        uint32_t length;
+    };
+
+    // Ogni blocco richiesto ha un proprietario: un peer riceve prima i blocchi
+    // liberi dei pezzi gia' iniziati, poi quelli di un nuovo pezzo rarest-first.
+    uint32_t registerPeer() { return next_peer_id++; }
+    size_t assignBlocks(uint32_t peerId, const uint8_t* peer_bf, size_t peerPieceCount, size_t maxBlocks, std::vector<BlockRequest>& out);
+    // Choke o disconnessione: i blocchi del peer tornano assegnabili
+    void releaseBlocks(uint32_t peerId);
+
+    // Endgame: quando ogni blocco mancante e' gia' richiesto, gli stessi blocchi
+    // vengono chiesti a tutti i peer che li hanno; all'arrivo del primo gli altri
+    // richiedenti ricevono un CANCEL tramite questo handler.
+    using CancelHandler = std::function<void(uint32_t peerId, const BlockRequest& req)>;
+    void setCancelHandler(CancelHandler handler) { cancel_handler = std::move(handler); }
+    bool inEndgame() const { return endgame.load(std::memory_order_relaxed); }
+
+    // Ogni pezzo appena scritto e verificato va annunciato con un HAVE a tutti
+    // i peer collegati. Lo chiamano i thread del disco e della riverifica, che
+    // possono essere attivi mentre il reactor nasce o viene distrutto
+    using HaveHandler = std::function<void(uint32_t index)>;
+    void setHaveHandler(HaveHandler handler);
+
+    // Contatori di disponibilita' nello swarm per il picker rarest-first
+    void peerHave(uint32_t index);
+    // peer_bf: formato del messaggio BITFIELD, almeno getBitfield().byteSize() byte
+    void peerBitfield(const uint8_t* peer_bf);
+    void peerDisconnected(const uint8_t* peer_bf);
+    uint32_t getNumPieces() const { return num_pieces; }
     
-    long long getDownloadedBytes() const;
+    // Contatori di avanzamento aggiornati a ogni evento, letti in blocco
+    // senza toccare i lock dei pezzi
+    struct Stats {
+        long long verified = 0;     // byte dei pezzi verificati, l'ultimo con la sua lunghezza reale
+        long long in_flight = 0;    // byte ricevuti in pezzi non ancora verificati
+        long long wasted = 0;       // byte buttati: hash errato, blocchi non piu' richiesti
+        long long transferred = 0;  // byte di payload ricevuti in totale
+    };
+    Stats getStats() const;
+
+    long long getDownloadedBytes() const { return getStats().verified; }
     long long getLeftBytes() const;
-    uint32_t getPieceLength(uint32_t index);
+    uint32_t getPieceLength(uint32_t index) const;
 
-    bool addBlock(uint32_t index, uint32_t begin, const uint8_t* blockData, size_t blockSize);
+    // Ricezione in due fasi: reserveBlock restituisce il punto del buffer del
+    // pezzo in cui il socket scrive direttamente il blocco (nullptr se il pezzo
+    // non e' in download o il blocco non serve piu'), commitBlock lo segna come ricevuto e restituisce true se
+    // il pezzo e' completo e passa alla verifica. abortBlock annulla la riserva.
+    uint8_t* reserveBlock(uint32_t index, uint32_t begin, uint32_t length);
+    bool commitBlock(uint32_t index, uint32_t begin, uint32_t length, uint32_t peerId);
+    void abortBlock(uint32_t index, uint32_t begin);
+    // Corpo di un PIECE letto e scartato perche' reserveBlock non l'ha accettato
+    void discardBlock(uint32_t length) { _countBlock(0, length, length); }
 
-    void setPiecesHashes(const std::string& hashes) {
-        this->pieces_hashes = hashes;
-    }
+    // Hash dei pezzi e tabella dei file; meta deve sopravvivere al PieceManager
+    void setMetainfo(const Metainfo* meta) { this->metainfo = meta; }
+    // I pezzi verificati vengono scritti qui, in modo asincrono; storage deve
+    // sopravvivere al PieceManager
+    void setStorage(Storage* s);
+    const char* diskBackend() const { return disk_io ? disk_io->backendName() : "nessuno"; }
 
-    void saveToDisk(uint32_t index, const std::vector<uint8_t>& data);
-    void setFilesList(const std::vector<FileInfo>& files) { this->filesList = files; }
+    // false se la scrittura fallisce: il pezzo non viene segnato come completo
+    bool saveToDisk(uint32_t index, const uint8_t* data, size_t len);
 
+    // Upload: parte del blocco [begin, begin + len) di un pezzo verificato
+    // inviata al socket direttamente dai file (vedi Storage::sendTo)
+    ssize_t sendBlock(int sockfd, uint32_t index, uint32_t begin, size_t len);
+    void addUploaded(size_t bytes) { stat_uploaded.fetch_add(bytes, std::memory_order_relaxed); }
+    long long getUploadedBytes() const { return stat_uploaded.load(std::memory_order_relaxed); }
 
-    std::vector<uint8_t>& getBitfield();
-    std::shared_mutex& getMutex();
-    long long getTotalTransferred() const { return total_transferred.load(); }
 
-    void setStateFile(const std::string& infoHashHex) {
-    
-    std::filesystem::create_directories("resume_data");
-    this->state_filename = "resume_data/" + infoHashHex + ".resume";
-    }
+    const Bitfield& getBitfield() const { return global_bitfield; }
+    long long getTotalTransferred() const { return getStats().transferred; }
+
+    // Apre il registro di resume (istantanea + journal) e avvia il thread dei commit
+    void setStateFile(const std::string& infoHashHex);
 
+    // Il registro contiene, oltre al bitfield, dimensione e mtime di ogni
+    // file: un pezzo e' considerato valido solo se i suoi file non sono cambiati
+    // da allora. Gli altri pezzi i cui dati potrebbero essere su disco finiscono
+    // nella lista da ricontrollare. Richiede setMetainfo.
     void loadBitfield();
+    // Istantanea completa dei pezzi gia' registrati, con gli stamp attuali di
+    // tutti i file; azzera il journal
     void saveBitfield();
 
+    // Pezzi incompleti salvati alla chiusura precedente: i blocchi gia' scritti
+    // vengono riletti dai file e solo quelli mancanti tornano da richiedere.
+    // Richiede setStorage; va chiamata prima che i peer si colleghino.
+    void restorePartials();
+
+    // Verifica in background dei pezzi scelti da loadBitfield, su threads
+    // thread (al massimo RECHECK_MAX_THREADS) a letture sequenziali grandi;
+    // intanto il picker non li assegna. I buffer sono slot del pool dei pezzi,
+    // quindi dentro il budget di memoria. Richiede setStorage e file gia' preparati.
+    void startRecheck(size_t threads);
+    bool recheckRunning() const { return recheck_running.load(std::memory_order_relaxed) > 0; }
+
 private:
-    int countSetBits(uint8_t n) const;
+    bool _markAsComplete(int pieceIndex);
+    void _addStats(long long verified, long long inFlight, long long wasted, long long transferred);
+    void _countBlock(long long inFlight, long long wasted, long long transferred);
+    void onPieceHashed(uint32_t index, bool ok, const uint8_t* data, size_t len);
+    void onPieceWritten(uint32_t index, bool ok, size_t len);
+    void _recheckLoop(std::vector<int> buffers);
+    void _finishRecheck();
+    // Con save_mutex preso
+    void _restamp(size_t file);
+    std::vector<FileStamp> _savedStamps() const;
+    // I pezzi scritti entrano nel journal a gruppi: ogni COMMIT_INTERVAL o appena
+    // ne sono in coda COMMIT_PIECES, sempre dopo il flush dei loro dati
+    void _queueCommit(uint32_t index);
+    void _commitLoop();
+    bool _commit(const std::vector<uint32_t>& pieces);
+    // Alla chiusura: i blocchi ricevuti dei pezzi incompleti finiscono nei file
+    void _savePartials();
+    // Troppi byte in attesa di scrittura: niente pezzi nuovi finche' il disco non recupera
+    bool _writeBacklogged() const { return disk_io && disk_io->pendingBytes() >= max_write_backlog; }
 
-    void _markAsComplete(int pieceIndex);
+    enum BlockState : uint8_t { BLOCK_MISSING, BLOCK_WRITING, BLOCK_RECEIVED };
 
+    // Uno per slot del BufferPool, riusato da un pezzo all'altro: i vettori
+    // per blocco sono dimensionati una volta sola sul pezzo piu' lungo.
     struct PieceProgress {
-    std::vector<uint8_t> buffer;
-    std::vector<bool> blocks_received; 
+    std::mutex mtx;
+    bool active = false;               // lo slot appartiene ancora a index
+    uint8_t* buffer = nullptr;
+    uint32_t index = 0;
+    uint32_t length = 0;
+    uint32_t num_blocks = 0;
+    std::vector<uint8_t> block_state;
+    std::vector<uint32_t> block_owner; // 0 = nessuna richiesta in corso
+    size_t unassigned = 0;             // blocchi ne' ricevuti ne' richiesti
     size_t bytes_received = 0;
+    bool hashing = false;
+    std::vector<std::pair<uint32_t, uint32_t>> extra_requests; // endgame: (blocco, peer)
     };
 
-    std::map<uint32_t, PieceProgress> in_progress; 
-    std::string pieces_hashes; 
+    // Senza lock: lo slot va ricontrollato (active, index) dopo averne preso il mutex
+    PieceProgress* _findPiece(uint32_t index) {
+        int32_t slot = piece_slot[index].load(std::memory_order_acquire);
+        return slot < 0 ? nullptr : &slots[slot];
+    }
+    PieceProgress* _lockPiece(uint32_t index, std::unique_lock<std::mutex>& lock);
+    PieceProgress* _startPiece(uint32_t index);
+    void _releasePiece(uint32_t index);
+    size_t _assignFrom(uint32_t index, PieceProgress& p, uint32_t peerId, size_t maxBlocks, std::vector<BlockRequest>& out);
+    size_t _assignEndgame(uint32_t peerId, const uint8_t* peer_bf, size_t maxBlocks, std::vector<BlockRequest>& out);
+
+    const Metainfo* metainfo = nullptr;
+    Storage* storage = nullptr;
+
+    uint32_t num_pieces;
+
+    std::mutex picker_mutex;
+    PiecePicker picker;
+
+    BufferPool buffer_pool;
+    std::vector<PieceProgress> slots;   // indicizzato come gli slot del pool
+    std::unique_ptr<std::atomic<int32_t>[]> piece_slot; // per pezzo: slot occupato, -1 se non avviato
+    std::vector<uint32_t> active_slots; // slot in uso, in ordine di avvio
+    std::atomic<uint32_t> next_peer_id{1};
+
+    std::atomic<bool> endgame{false};
+    CancelHandler cancel_handler;
+    std::mutex have_mutex;
+    HaveHandler have_handler;               // protetto da have_mutex
+    void _announceHave(uint32_t index);
+
+    std::mutex save_mutex;
+    std::unique_ptr<ResumeJournal> journal; // protetti da save_mutex
+    std::vector<uint8_t> committed;        // pezzi gia' nel registro, formato BITFIELD
+    std::vector<FileStamp> file_stamps;
+    std::vector<uint8_t> file_stale;       // contenuto non ancora riverificato: salvato senza mtime
+    std::vector<PartialPiece> partials;    // da loadBitfield a restorePartials, poi quelli della chiusura
+
+    static constexpr size_t COMMIT_PIECES = 64;
+    static constexpr std::chrono::milliseconds COMMIT_INTERVAL{1000};
+    // Oltre questa dimensione (o quella dell'istantanea) il journal viene compattato
+    static constexpr size_t JOURNAL_COMPACT_BYTES = 1024 * 1024;
+
+    std::mutex commit_mutex;
+    std::condition_variable commit_cv;
+    std::vector<uint32_t> pending_commits; // protetti da commit_mutex
+    bool commit_stop = false;
+    std::thread commit_thread;
+
+    // Pezzi consecutivi letti in sequenza e verificati con un solo hash_many
+    struct RecheckChunk {
+        uint32_t first;
+        uint32_t count;
+    };
+    static constexpr uint32_t RECHECK_MAX_PIECES = 16;
+    static constexpr size_t RECHECK_MAX_THREADS = 4;
+
+    std::vector<uint32_t> recheck_list;    // scritta da loadBitfield, letta da startRecheck
+    std::vector<RecheckChunk> recheck_chunks;
+    std::atomic<size_t> recheck_next{0};
+    std::atomic<size_t> recheck_running{0};
+    std::atomic<bool> recheck_stop{false};
+    std::atomic<long long> recheck_bytes{0};
+    std::atomic<uint32_t> recheck_valid{0};
+    std::chrono::steady_clock::time_point recheck_start;
+    std::vector<std::thread> recheck_threads;
+
+    // Seqlock: gli scrittori si serializzano su stats_mutex e rendono dispari
+    // stats_seq durante l'aggiornamento; getStats ripete la lettura se la
+    // sequenza e' dispari o e' cambiata nel frattempo. Ci passano solo gli
+    // spostamenti fra contatori di un pezzo intero (in_flight -> verified o
+    // wasted); i blocchi ricevuti usano _countBlock, un fetch_add relaxed
+    // senza lock che il seqlock non ordina: una lettura puo' vedere
+    // transferred avanti di un blocco rispetto a in_flight.
+    std::mutex stats_mutex;
+    std::atomic<uint32_t> stats_seq{0};
+    std::atomic<long long> stat_verified{0};
+    std::atomic<long long> stat_in_flight{0};
+    std::atomic<long long> stat_wasted{0};
+    std::atomic<long long> stat_transferred{0};
+    std::atomic<long long> stat_uploaded{0};    // fuori dal seqlock: nessuna lettura combinata
+
+    std::unique_ptr<HashPool> hash_pool;
+    std::unique_ptr<DiskIO> disk_io;
+    size_t max_write_backlog;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include "piecePicker.hpp"
+#include <algorithm>
+
+PiecePicker::PiecePicker(uint32_t numPieces)
+    : availability(numPieces, 0), order(numPieces), pos(numPieces), rng(std::random_device{}())
+{
+    for (uint32_t i = 0; i < numPieces; ++i) order[i] = i;
+    std::shuffle(order.begin(), order.end(), rng);
+    for (uint32_t i = 0; i < numPieces; ++i) pos[order[i]] = i;
+
+    bucket_start = {0, numPieces};
+}
+
+void PiecePicker::swapPositions(uint32_t a, uint32_t b) {
+    if (a == b) return;
+    std::swap(order[a], order[b]);
+    pos[order[a]] = a;
+    pos[order[b]] = b;
+}
+
+void PiecePicker::ensureBucket(uint32_t bucket) {
+    while (bucket_start.size() < (size_t)bucket + 2) {
+        bucket_start.push_back(order.size());
+    }
+}
+
+void PiecePicker::shuffleInto(uint32_t piece, uint32_t bucket) {
+    uint32_t first = bucket_start[bucket];
+    uint32_t end = bucket_start[bucket + 1];
+    if (end - first < 2) return;
+
+    std::uniform_int_distribution<uint32_t> dist(first, end - 1);
+    swapPositions(pos[piece], dist(rng));
+}
+
+void PiecePicker::incAvailability(uint32_t piece) {
+    if (piece >= availability.size()) return;
+    uint32_t a = availability[piece]++;
+    if (pos[piece] < 0) return;
+
+    ensureBucket(a + 1);
+    uint32_t last = bucket_start[a + 1] - 1;
+    swapPositions(pos[piece], last);
+    bucket_start[a + 1]--;
+    shuffleInto(piece, a + 1);
+}
+
+void PiecePicker::decAvailability(uint32_t piece) {
+    if (piece >= availability.size() || availability[piece] == 0) return;
+    uint32_t a = availability[piece]--;
+    if (pos[piece] < 0) return;
+
+    uint32_t first = bucket_start[a];
+    swapPositions(pos[piece], first);
+    bucket_start[a]++;
+    shuffleInto(piece, a - 1);
+}
+
+void PiecePicker::setHave(uint32_t piece) {
+    if (piece >= availability.size() || pos[piece] < 0) return;
+
+    // Il pezzo scivola in fondo attraversando i bucket successivi: un
+    // scambio per bucket, poi esce dal vettore.
+    uint32_t i = pos[piece];
+    size_t numBuckets = bucket_start.size() - 1;
+    for (size_t b = availability[piece]; b < numBuckets; ++b) {
+        uint32_t last = bucket_start[b + 1] - 1;
+        swapPositions(i, last);
+        i = last;
+        bucket_start[b + 1]--;
+    }
+
+    order.pop_back();
+    pos[piece] = -1;
+}
+
+void PiecePicker::unsetHave(uint32_t piece) {
+    if (piece >= availability.size() || pos[piece] >= 0) return;
+
+    // Il contrario di setHave: entra in coda all'ultimo bucket e risale
+    // con uno scambio per bucket fino al proprio
+    uint32_t a = availability[piece];
+    ensureBucket(a);
+    uint32_t i = order.size();
+    order.push_back(piece);
+    pos[piece] = i;
+
+    size_t numBuckets = bucket_start.size() - 1;
+    bucket_start[numBuckets]++;
+    for (size_t b = numBuckets - 1; b > a; --b) {
+        uint32_t first = bucket_start[b];
+        swapPositions(i, first);
+        i = first;
+        bucket_start[b]++;
+    }
+    shuffleInto(piece, a);
+}
+
+int PiecePicker::pick(const uint8_t* peer_bf, size_t peerCount, const std::function<bool(uint32_t)>& skip) {
+    if (order.empty()) return -1;
+
+    // Peer con pochi pezzi: conviene scorrere i suoi e tenere il piu' raro
+    if (peerCount * 8 < order.size()) {
+        int best = -1;
+        uint32_t bestAvail = UINT32_MAX;
+        uint32_t ties = 0;
+        forEachSetBit(peer_bf, pos.size(), [&](uint32_t piece) {
+            if (pos[piece] < 0 || skip(piece)) return;
+
+            uint32_t a = availability[piece];
+            if (a < bestAvail) {
+                bestAvail = a;
+                best = piece;
+                ties = 1;
+            } else if (a == bestAvail && std::uniform_int_distribution<uint32_t>(0, ties++)(rng) == 0) {
+                best = piece;
+            }
+        });
+        return best;
+    }
+
+    // Il bucket 0 contiene pezzi che nessun peer annuncia: si parte dal successivo
+    for (size_t i = bucket_start[1]; i < order.size(); ++i) {
+        uint32_t piece = order[i];
+        if (hasBit(peer_bf, piece) && !skip(piece)) return piece;
+    }
+    return -1;
+}
@@ -0,0 +1,50 @@
+#ifndef PIECEPICKER_HPP
+#define PIECEPICKER_HPP
+
+#include <vector>
+#include <cstdint>
+#include <random>
+#include <functional>
+#include "bitfield.hpp"
+
+// Rarest-first: i pezzi ancora da scaricare sono tenuti ordinati per
+// disponibilita' nello swarm, divisi in bucket contigui (uno per ogni valore
+// del contatore). Spostare un pezzo tra bucket adiacenti costa uno scambio,
+// e dentro ogni bucket l'ordine e' casuale.
+class PiecePicker {
+public:
+    explicit PiecePicker(uint32_t numPieces);
+
+    void incAvailability(uint32_t piece);
+    void decAvailability(uint32_t piece);
+    uint32_t getAvailability(uint32_t piece) const { return availability[piece]; }
+
+    // Il pezzo e' verificato: non e' piu' un candidato
+    void setHave(uint32_t piece);
+    // Il pezzo torna candidato, nel bucket della sua disponibilita'
+    void unsetHave(uint32_t piece);
+    size_t remaining() const { return order.size(); }
+
+    // peerCount = numero di pezzi che il peer possiede, per scegliere la
+    // strategia di scansione meno costosa
+    // peer_bf: bitfield del peer nel formato del messaggio BITFIELD
+    int pick(const uint8_t* peer_bf, size_t peerCount, const std::function<bool(uint32_t)>& skip);
+
+private:
+    void swapPositions(uint32_t a, uint32_t b);
+    void shuffleInto(uint32_t piece, uint32_t bucket);
+    void ensureBucket(uint32_t bucket);
+
+    static bool hasBit(const uint8_t* bf, uint32_t piece) {
+        return bf[piece / 8] & (1 << (7 - (piece % 8)));
+    }
+
+    std::vector<uint32_t> availability;
+    std::vector<uint32_t> order;        // pezzi mancanti, per disponibilita' crescente
+    std::vector<int32_t> pos;           // posizione in order, -1 se gia' posseduto
+    std::vector<uint32_t> bucket_start; // bucket_start[a] = primo indice con disponibilita' >= a
+
+    std::mt19937 rng;
+};
+
+#endif
@@ -0,0 +1,284 @@
+#include "resumeJournal.hpp"
+#include <iostream>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Istantanea: magic, numero di file, generazione, numero di pezzi, FileStamp per
+// file, bitfield, pezzi incompleti (numero, poi indice, byte e bitmap di
+// ciascuno), checksum. Journal: magic, generazione, poi i gruppi.
+static const char SNAPSHOT_MAGIC[4] = {'T', 'R', 'S', '3'};
+static const char JOURNAL_MAGIC[4] = {'T', 'R', 'J', '1'};
+static const size_t JOURNAL_HEADER = 16;
+static const size_t STAMP_RECORD = 4 + 8 + 8;
+
+// FNV-1a: basta a riconoscere un gruppo scritto a meta'
+static uint64_t checksum(const uint8_t* p, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+template <typename T>
+static void put(std::vector<uint8_t>& out, T value) {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(&value);
+    out.insert(out.end(), p, p + sizeof(T));
+}
+
+template <typename T>
+static bool get(const std::vector<uint8_t>& in, size_t& pos, T& value) {
+    if (in.size() - pos < sizeof(T)) return false;
+    std::memcpy(&value, in.data() + pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+
+static bool readFile(const std::string& path, std::vector<uint8_t>& out) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    uint8_t buf[65536];
+    while (true) {
+        ssize_t r = read(fd, buf, sizeof(buf));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        out.insert(out.end(), buf, buf + r);
+    }
+    close(fd);
+    return true;
+}
+
+static bool writeAll(int fd, const uint8_t* p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += w;
+        n -= w;
+    }
+    return true;
+}
+
+ResumeJournal::ResumeJournal(const std::string& basePath)
+    : snapshot_path(basePath + ".resume"), journal_path(basePath + ".journal") {}
+
+ResumeJournal::~ResumeJournal() {
+    if (journal_fd >= 0) close(journal_fd);
+}
+
+bool ResumeJournal::load(uint32_t numPieces, size_t numFiles, std::vector<uint8_t>& bitfield, std::vector<FileStamp>& stamps,
+                         std::vector<PartialPiece>& partials) {
+    num_pieces = numPieces;
+    bitfield.assign((numPieces + 7) / 8, 0);
+    stamps.assign(numFiles, FileStamp());
+    partials.clear();
+
+    std::vector<uint8_t> snap;
+    bool valid = readFile(snapshot_path, snap);
+    size_t pos = 0;
+    uint32_t files = 0, pieces = 0;
+    uint64_t gen = 0;
+    valid = valid && snap.size() >= sizeof(SNAPSHOT_MAGIC) + 8 && std::memcmp(snap.data(), SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) == 0;
+    pos = sizeof(SNAPSHOT_MAGIC);
+    valid = valid && get(snap, pos, files) && get(snap, pos, gen) && get(snap, pos, pieces);
+    // Un registro di un'altra versione o di un altro torrent non vale nulla
+    valid = valid && files == numFiles && pieces == numPieces &&
+            snap.size() >= pos + numFiles * sizeof(FileStamp) + bitfield.size() + 4 + 8;
+    if (valid) {
+        uint64_t stored;
+        std::memcpy(&stored, snap.data() + snap.size() - 8, 8);
+        valid = stored == checksum(snap.data(), snap.size() - 8);
+    }
+    if (valid) {
+        // Il checksum copre tutto: i pezzi incompleti si possono leggere senza altri controlli di lunghezza
+        size_t ppos = pos + numFiles * sizeof(FileStamp) + bitfield.size();
+        snap.resize(snap.size() - 8);
+        uint32_t count = 0;
+        valid = get(snap, ppos, count);
+        for (uint32_t i = 0; i < count && valid; ++i) {
+            PartialPiece p;
+            uint32_t bytes = 0;
+            valid = get(snap, ppos, p.index) && get(snap, ppos, bytes) && p.index < numPieces && snap.size() - ppos >= bytes;
+            if (!valid) break;
+            p.blocks.assign(snap.begin() + ppos, snap.begin() + ppos + bytes);
+            ppos += bytes;
+            partials.push_back(std::move(p));
+        }
+        valid = valid && ppos == snap.size();
+        if (!valid) partials.clear();
+    }
+    if (!valid) {
+        // Si riparte da un'istantanea vuota: senza, i gruppi del journal non
+        // avrebbero una generazione a cui appartenere
+        generation = 0;
+        if (_openJournal(0)) compact(bitfield, stamps);
+        return false;
+    }
+
+    std::memcpy(stamps.data(), snap.data() + pos, numFiles * sizeof(FileStamp));
+    pos += numFiles * sizeof(FileStamp);
+    std::memcpy(bitfield.data(), snap.data() + pos, bitfield.size());
+    generation = gen;
+
+    // Gruppi del journal in ordine, fino al primo non valido
+    std::vector<uint8_t> journal;
+    size_t validBytes = 0;
+    uint64_t journalGen = 0;
+    if (readFile(journal_path, journal) && journal.size() >= JOURNAL_HEADER &&
+        std::memcmp(journal.data(), JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) == 0) {
+        std::memcpy(&journalGen, journal.data() + 8, 8);
+    }
+    if (journalGen == generation && journal.size() >= JOURNAL_HEADER) {
+        validBytes = JOURNAL_HEADER;
+        pos = JOURNAL_HEADER;
+        while (true) {
+            size_t start = pos;
+            uint32_t nPieces = 0, nStamps = 0;
+            if (!get(journal, pos, nPieces) || !get(journal, pos, nStamps)) break;
+            size_t body = (size_t)nPieces * 4 + (size_t)nStamps * STAMP_RECORD;
+            if (nPieces > numPieces || nStamps > numFiles || journal.size() - pos < body + 8) break;
+
+            uint64_t stored;
+            std::memcpy(&stored, journal.data() + pos + body, 8);
+            if (stored != checksum(journal.data() + start, pos + body - start)) break;
+
+            bool ok = true;
+            for (uint32_t i = 0; i < nPieces && ok; ++i) {
+                uint32_t index = 0;
+                get(journal, pos, index);
+                if (index < numPieces) bitfield[index / 8] |= 0x80 >> (index % 8);
+                else ok = false;
+            }
+            for (uint32_t i = 0; i < nStamps && ok; ++i) {
+                uint32_t file = 0;
+                FileStamp s;
+                get(journal, pos, file);
+                get(journal, pos, s.size);
+                get(journal, pos, s.mtime);
+                if (file < numFiles) stamps[file] = s;
+                else ok = false;
+            }
+            if (!ok) break;
+            pos += 8;
+            validBytes = pos;
+        }
+    }
+
+    _openJournal(validBytes);
+
+    partials.erase(std::remove_if(partials.begin(), partials.end(), [&](const PartialPiece& p) {
+        return bitfield[p.index / 8] & (0x80 >> (p.index % 8));
+    }), partials.end());
+    return true;
+}
+
+bool ResumeJournal::commit(const std::vector<uint32_t>& pieces, const std::vector<std::pair<uint32_t, FileStamp>>& stamps) {
+    if (journal_fd < 0) return false;
+
+    std::vector<uint8_t> group;
+    group.reserve(8 + pieces.size() * 4 + stamps.size() * STAMP_RECORD + 8);
+    put<uint32_t>(group, pieces.size());
+    put<uint32_t>(group, stamps.size());
+    for (uint32_t index : pieces) put(group, index);
+    for (const auto& s : stamps) {
+        put(group, s.first);
+        put(group, s.second.size);
+        put(group, s.second.mtime);
+    }
+    put(group, checksum(group.data(), group.size()));
+
+    if (!writeAll(journal_fd, group.data(), group.size()) || fdatasync(journal_fd) != 0) {
+        std::cerr << "\n[ERRORE] Scrittura del journal fallita: " << journal_path << " (Errore: " << strerror(errno) << ")" << std::endl;
+        // Un gruppo a meta' renderebbe irraggiungibili quelli successivi
+        if (ftruncate(journal_fd, journal_bytes) != 0) {
+            close(journal_fd);
+            journal_fd = -1;
+        }
+        return false;
+    }
+    journal_bytes += group.size();
+    return true;
+}
+
+bool ResumeJournal::compact(const std::vector<uint8_t>& bitfield, const std::vector<FileStamp>& stamps,
+                            const std::vector<PartialPiece>& partials) {
+    std::vector<uint8_t> snap;
+    snap.insert(snap.end(), SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + sizeof(SNAPSHOT_MAGIC));
+    put<uint32_t>(snap, stamps.size());
+    put<uint64_t>(snap, generation + 1);
+    put<uint32_t>(snap, num_pieces);
+    const uint8_t* s = reinterpret_cast<const uint8_t*>(stamps.data());
+    snap.insert(snap.end(), s, s + stamps.size() * sizeof(FileStamp));
+    snap.insert(snap.end(), bitfield.begin(), bitfield.end());
+    put<uint32_t>(snap, partials.size());
+    for (const PartialPiece& p : partials) {
+        put(snap, p.index);
+        put<uint32_t>(snap, p.blocks.size());
+        snap.insert(snap.end(), p.blocks.begin(), p.blocks.end());
+    }
+    put(snap, checksum(snap.data(), snap.size()));
+
+    std::string tmp = snapshot_path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 || !writeAll(fd, snap.data(), snap.size()) || fsync(fd) != 0) {
+        std::cerr << "\n[ERRORE] Impossibile scrivere il file: " << tmp << " (Errore: " << strerror(errno) << ")" << std::endl;
+        if (fd >= 0) close(fd);
+        return false;
+    }
+    close(fd);
+
+    if (rename(tmp.c_str(), snapshot_path.c_str()) != 0) {
+        std::cerr << "\n[ERRORE] Impossibile sostituire il file: " << snapshot_path << " (Errore: " << strerror(errno) << ")" << std::endl;
+        return false;
+    }
+    // Il rename e' durevole solo con la cartella sincronizzata
+    std::string dir = std::filesystem::path(snapshot_path).parent_path().string();
+    int dfd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd >= 0) {
+        fsync(dfd);
+        close(dfd);
+    }
+
+    // Da qui il journal vecchio e' superato anche se il reset non arrivasse su disco
+    generation++;
+    return _resetJournal();
+}
+
+bool ResumeJournal::_openJournal(size_t validBytes) {
+    if (journal_fd < 0) {
+        journal_fd = open(journal_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (journal_fd < 0) {
+            std::cerr << "\n[ERRORE] Impossibile aprire il journal: " << journal_path << " (Errore: " << strerror(errno) << ")" << std::endl;
+            return false;
+        }
+    }
+    if (validBytes < JOURNAL_HEADER) return _resetJournal();
+
+    // Coda incompleta di un crash: va tolta prima di aggiungere altri gruppi
+    if (ftruncate(journal_fd, validBytes) != 0) return false;
+    journal_bytes = validBytes;
+    return true;
+}
+
+bool ResumeJournal::_resetJournal() {
+    if (journal_fd < 0) return false;
+
+    std::vector<uint8_t> header;
+    header.insert(header.end(), JOURNAL_MAGIC, JOURNAL_MAGIC + sizeof(JOURNAL_MAGIC));
+    put<uint32_t>(header, 0);
+    put<uint64_t>(header, generation);
+
+    if (ftruncate(journal_fd, 0) != 0 || !writeAll(journal_fd, header.data(), header.size()) || fdatasync(journal_fd) != 0) {
+        std::cerr << "\n[ERRORE] Impossibile azzerare il journal: " << journal_path << " (Errore: " << strerror(errno) << ")" << std::endl;
+        return false;
+    }
+    journal_bytes = header.size();
+    return true;
+}
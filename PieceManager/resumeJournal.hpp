@@ -0,0 +1,70 @@
+#ifndef RESUMEJOURNAL_HPP
+#define RESUMEJOURNAL_HPP
+
+#include <vector>
+#include <string>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+// Dimensione e mtime (ns) di un file quando e' stato registrato; -1 se assente
+// o, per mtime, se il contenuto non e' ancora stato riverificato
+struct FileStamp {
+    long long size = -1;
+    long long mtime = -1;
+};
+
+// Pezzo incompleto: i blocchi da 16 KiB gia' scritti nei file, un bit per
+// blocco nel formato del BITFIELD
+struct PartialPiece {
+    uint32_t index = 0;
+    std::vector<uint8_t> blocks;
+};
+
+// Registro di resume in due file accanto a base:
+//  - base.resume: istantanea completa (stamp dei file, bitfield e pezzi
+//    incompleti), sostituita solo con tmp + fsync + rename;
+//  - base.journal: gruppi di pezzi completati aggiunti in coda, ognuno con i
+//    nuovi stamp dei suoi file e un checksum.
+// Un gruppo troncato da un crash non supera il checksum e viene scartato con
+// tutto cio' che lo segue. Istantanea e journal portano la stessa generazione:
+// un journal di una generazione precedente e' gia' incluso nell'istantanea.
+// Non thread-safe: il chiamante serializza.
+class ResumeJournal {
+public:
+    explicit ResumeJournal(const std::string& basePath);
+    ~ResumeJournal();
+
+    ResumeJournal(const ResumeJournal&) = delete;
+    ResumeJournal& operator=(const ResumeJournal&) = delete;
+
+    // Istantanea piu' journal. bitfield e stamps vengono sempre dimensionati;
+    // false se non c'e' un'istantanea valida per questo torrent. Prepara anche
+    // il journal per le aggiunte, tagliando un eventuale gruppo incompleto.
+    // I pezzi incompleti completati poi nel journal non vengono restituiti.
+    bool load(uint32_t numPieces, size_t numFiles, std::vector<uint8_t>& bitfield, std::vector<FileStamp>& stamps,
+              std::vector<PartialPiece>& partials);
+
+    // Un gruppo in coda al journal, su disco (fdatasync) prima del ritorno
+    bool commit(const std::vector<uint32_t>& pieces, const std::vector<std::pair<uint32_t, FileStamp>>& stamps);
+
+    // Nuova istantanea con generazione successiva, poi journal azzerato.
+    // Richiede una load() precedente, che fissa il numero di pezzi
+    bool compact(const std::vector<uint8_t>& bitfield, const std::vector<FileStamp>& stamps,
+                 const std::vector<PartialPiece>& partials = {});
+
+    size_t journalBytes() const { return journal_bytes; }
+
+private:
+    bool _openJournal(size_t validBytes);
+    bool _resetJournal();
+
+    std::string snapshot_path;
+    std::string journal_path;
+    int journal_fd = -1;
+    size_t journal_bytes = 0;
+    uint64_t generation = 0;
+    uint32_t num_pieces = 0;
+};
+
+#endif
@@ -0,0 +1,66 @@
+#include "choker.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+Choker::Choker(size_t slots) : regular_slots(slots), rng(std::random_device{}()) {}
+
+void Choker::update(const std::vector<Candidate>& peers, bool seeding, std::chrono::steady_clock::time_point now,
+                    std::vector<std::pair<uint32_t, bool>>& changes) {
+    std::unordered_map<uint32_t, const Candidate*> byId;
+    for (const Candidate& c : peers) byId[c.peer_id] = &c;
+
+    // I peer disconnessi liberano il loro slot senza bisogno di un CHOKE
+    for (auto it = unchoked.begin(); it != unchoked.end();) {
+        if (byId.count(*it)) ++it;
+        else it = unchoked.erase(it);
+    }
+    if (optimistic != 0 && !byId.count(optimistic)) optimistic = 0;
+
+    std::vector<const Candidate*> interested;
+    for (const Candidate& c : peers) {
+        if (c.interested) interested.push_back(&c);
+    }
+
+    std::unordered_set<uint32_t> next;
+    if (!started || seeding != was_seeding || now - last_round >= CHOKE_INTERVAL) {
+        started = true;
+        was_seeding = seeding;
+        last_round = now;
+
+        // A parita' di velocita' l'ordine e' casuale: nessun peer resta escluso per sempre
+        std::shuffle(interested.begin(), interested.end(), rng);
+        std::stable_sort(interested.begin(), interested.end(), [seeding](const Candidate* a, const Candidate* b) {
+            return seeding ? a->upload_rate > b->upload_rate : a->download_rate > b->download_rate;
+        });
+        for (size_t i = 0; i < interested.size() && i < regular_slots; ++i) next.insert(interested[i]->peer_id);
+
+        bool keep = optimistic != 0 && now - optimistic_since < OPTIMISTIC_INTERVAL &&
+                    byId[optimistic]->interested && !next.count(optimistic);
+        if (!keep) {
+            optimistic = 0;
+            std::vector<uint32_t> rest;
+            for (const Candidate* c : interested) {
+                if (!next.count(c->peer_id)) rest.push_back(c->peer_id);
+            }
+            if (!rest.empty()) {
+                optimistic = rest[std::uniform_int_distribution<size_t>(0, rest.size() - 1)(rng)];
+                optimistic_since = now;
+            }
+        }
+        if (optimistic != 0) next.insert(optimistic);
+    } else {
+        next = unchoked;
+        for (const Candidate* c : interested) {
+            if (next.size() >= regular_slots + 1) break;
+            next.insert(c->peer_id);
+        }
+    }
+
+    for (uint32_t id : unchoked) {
+        if (!next.count(id)) changes.push_back({id, true});
+    }
+    for (uint32_t id : next) {
+        if (!unchoked.count(id)) changes.push_back({id, false});
+    }
+    unchoked.swap(next);
+}
@@ -0,0 +1,52 @@
+#ifndef CHOKER_HPP
+#define CHOKER_HPP
+
+#include <vector>
+#include <unordered_set>
+#include <utility>
+#include <cstdint>
+#include <chrono>
+#include <random>
+
+// Tit-for-tat: a ogni giro (CHOKE_INTERVAL) restano sbloccati gli slots peer
+// interessati che ci mandano piu' dati; in seed mode quelli a cui riusciamo a
+// mandarne di piu'. Uno slot in piu' e' ottimistico: va a un interessato
+// scelto a caso e ruota ogni OPTIMISTIC_INTERVAL, cosi' i peer nuovi hanno
+// modo di dimostrare quanto valgono. Tra un giro e l'altro gli slot liberi
+// vanno subito ai nuovi interessati, senza togliere nulla a nessuno.
+// Al passaggio in seed mode il giro parte subito: la classifica per
+// velocita' di ricezione non dice piu' nulla.
+class Choker {
+public:
+    struct Candidate {
+        uint32_t peer_id;
+        double download_rate;   // byte/s ricevuti dal peer
+        double upload_rate;     // byte/s inviati al peer
+        bool interested;
+    };
+
+    static constexpr std::chrono::seconds CHOKE_INTERVAL{10};
+    static constexpr std::chrono::seconds OPTIMISTIC_INTERVAL{30};
+
+    explicit Choker(size_t slots);
+
+    // peers: tutte le connessioni attive. In changes le variazioni da
+    // applicare, come (peer, true = choke)
+    void update(const std::vector<Candidate>& peers, bool seeding, std::chrono::steady_clock::time_point now,
+                std::vector<std::pair<uint32_t, bool>>& changes);
+
+    size_t slots() const { return regular_slots; }
+
+private:
+    size_t regular_slots;
+    std::unordered_set<uint32_t> unchoked;
+    uint32_t optimistic = 0;     // 0 = nessuno
+    bool started = false;
+    bool was_seeding = false;
+    std::chrono::steady_clock::time_point last_round;
+    std::chrono::steady_clock::time_point optimistic_since;
+
+    std::mt19937 rng;
+};
+
+#endif
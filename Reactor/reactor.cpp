@@ -0,0 +1,419 @@
+#include "reactor.hpp"
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cstring>
+#include <iostream>
+#include <chrono>
+
+Reactor::Reactor(size_t numThreads, const std::string& infoHash, const std::string& myId, PieceManager* pm,
+                 size_t uploadSlots)
+    : infoHash(infoHash), myId(myId), pm(pm), choker(uploadSlots)
+{
+    // Migliaia di socket richiedono di alzare il limite soft dei descrittori
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    if (numThreads == 0) numThreads = 1;
+    for (size_t i = 0; i < numThreads; ++i) {
+        auto loop = std::make_unique<Loop>();
+        loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+        loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (loop->epfd < 0 || loop->wakefd < 0) {
+            throw std::runtime_error("Impossibile inizializzare epoll");
+        }
+
+        struct epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev);
+
+        loops.push_back(std::move(loop));
+    }
+
+    pm->setCancelHandler([this](uint32_t peerId, const PieceManager::BlockRequest& req) { postCancel(peerId, req); });
+    pm->setHaveHandler([this](uint32_t index) { postHave(index); });
+}
+
+Reactor::~Reactor() {
+    stop();
+    pm->setCancelHandler(nullptr);
+    pm->setHaveHandler(nullptr);
+    if (listen_fd != -1) close(listen_fd);
+    for (auto& loop : loops) {
+        for (auto& [fd, peer] : loop->incoming) close(fd);
+        loop->conns.clear();
+        if (loop->wakefd != -1) close(loop->wakefd);
+        if (loop->epfd != -1) close(loop->epfd);
+    }
+}
+
+void Reactor::start() {
+    if (running.exchange(true)) return;
+    for (auto& loop : loops) {
+        Loop* l = loop.get();
+        l->t = std::thread([this, l]() { run(*l); });
+    }
+}
+
+void Reactor::stop() {
+    if (!running.exchange(false)) return;
+    for (auto& loop : loops) wake(*loop);
+    for (auto& loop : loops) {
+        if (loop->t.joinable()) loop->t.join();
+    }
+}
+
+void Reactor::wake(Loop& loop) {
+    uint64_t one = 1;
+    ssize_t r = write(loop.wakefd, &one, sizeof(one));
+    (void)r;
+}
+
+std::string Reactor::peerKey(const std::string& ip, uint16_t port) {
+    return ip + ":" + std::to_string(port);
+}
+
+bool Reactor::isPeerActive(const Peer& peer) const {
+    std::lock_guard<std::mutex> lock(active_mutex);
+    return active_peers.count(peerKey(peer.ip, peer.port)) > 0;
+}
+
+bool Reactor::listen(uint16_t port, size_t maxPeers) {
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        std::cerr << "\n[ERRORE] Impossibile creare il socket in ascolto (Errore: " << strerror(errno) << ")" << std::endl;
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    struct epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &listen_fd;
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || ::listen(listen_fd, SOMAXCONN) != 0 ||
+        epoll_ctl(loops[0]->epfd, EPOLL_CTL_ADD, listen_fd, &ev) != 0) {
+        std::cerr << "\n[ERRORE] Impossibile mettersi in ascolto sulla porta " << port << " (Errore: " << strerror(errno) << ")" << std::endl;
+        close(listen_fd);
+        listen_fd = -1;
+        return false;
+    }
+
+    max_incoming = maxPeers;
+    return true;
+}
+
+void Reactor::acceptIncoming() {
+    for (;;) {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        int fd = accept4(listen_fd, (struct sockaddr*)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            // EAGAIN: coda vuota; EMFILE e simili: si riprova al prossimo evento
+            return;
+        }
+
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &addr.sin_addr, ip, sizeof(ip));
+        Peer peer{ip, ntohs(addr.sin_port)};
+
+        if (active_count.load() >= max_incoming) {
+            close(fd);
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(active_mutex);
+            if (!active_peers.insert(peerKey(peer.ip, peer.port)).second) {
+                close(fd);
+                continue;
+            }
+        }
+        active_count++;
+
+        Loop& loop = *loops[next_loop++ % loops.size()];
+        {
+            std::lock_guard<std::mutex> lock(loop.pending_mutex);
+            loop.incoming.push_back({fd, peer});
+        }
+        wake(loop);
+    }
+}
+
+bool Reactor::addPeer(const Peer& peer) {
+    {
+        std::lock_guard<std::mutex> lock(active_mutex);
+        if (!active_peers.insert(peerKey(peer.ip, peer.port)).second) return false;
+    }
+    active_count++;
+
+    Loop& loop = *loops[next_loop++ % loops.size()];
+    {
+        std::lock_guard<std::mutex> lock(loop.pending_mutex);
+        loop.pending.push_back(peer);
+    }
+    wake(loop);
+    return true;
+}
+
+void Reactor::postCancel(uint32_t peerId, const PieceManager::BlockRequest& req) {
+    Loop* loop;
+    {
+        std::lock_guard<std::mutex> lock(active_mutex);
+        auto it = peer_loops.find(peerId);
+        if (it == peer_loops.end()) return;
+        loop = it->second;
+    }
+    {
+        std::lock_guard<std::mutex> lock(loop->pending_mutex);
+        loop->cancels.push_back({peerId, req});
+    }
+    wake(*loop);
+}
+
+void Reactor::deliverCancels(Loop& loop) {
+    std::vector<std::pair<uint32_t, PieceManager::BlockRequest>> batch;
+    {
+        std::lock_guard<std::mutex> lock(loop.pending_mutex);
+        batch.swap(loop.cancels);
+    }
+
+    for (const auto& [peerId, req] : batch) {
+        auto it = loop.by_id.find(peerId);
+        if (it == loop.by_id.end()) continue;
+        it->second->pc->sendCancel(req.index, req.begin, req.length);
+        updateInterest(loop, *it->second);
+    }
+}
+
+void Reactor::postHave(uint32_t index) {
+    for (auto& loop : loops) {
+        {
+            std::lock_guard<std::mutex> lock(loop->pending_mutex);
+            loop->haves.push_back(index);
+        }
+        wake(*loop);
+    }
+}
+
+void Reactor::deliverHaves(Loop& loop) {
+    std::vector<uint32_t> batch;
+    {
+        std::lock_guard<std::mutex> lock(loop.pending_mutex);
+        batch.swap(loop.haves);
+    }
+    if (batch.empty()) return;
+
+    for (auto& e : loop.conns) {
+        for (uint32_t index : batch) e->pc->sendHave(index);
+        updateInterest(loop, *e);
+    }
+}
+
+void Reactor::deliverChokes(Loop& loop) {
+    std::vector<std::pair<uint32_t, bool>> batch;
+    {
+        std::lock_guard<std::mutex> lock(loop.pending_mutex);
+        batch.swap(loop.chokes);
+    }
+
+    for (const auto& [peerId, choke] : batch) {
+        auto it = loop.by_id.find(peerId);
+        if (it == loop.by_id.end()) continue;
+        it->second->pc->setChoking(choke);
+        updateInterest(loop, *it->second);
+    }
+}
+
+void Reactor::publishRates(Loop& loop) {
+    std::lock_guard<std::mutex> lock(rates_mutex);
+    for (auto& e : loop.conns) {
+        const PeerConnection& pc = *e->pc;
+        if (!pc.isActive()) continue;
+        peer_rates[pc.getId()] = {&loop, {pc.getId(), pc.downloadRate(), pc.uploadRate(), pc.peerInterested()}};
+    }
+}
+
+void Reactor::runChoker(std::chrono::steady_clock::time_point now) {
+    std::vector<Choker::Candidate> candidates;
+    std::unordered_map<uint32_t, Loop*> owners;
+    {
+        std::lock_guard<std::mutex> lock(rates_mutex);
+        candidates.reserve(peer_rates.size());
+        for (const auto& [peerId, r] : peer_rates) {
+            candidates.push_back(r.candidate);
+            owners[peerId] = r.loop;
+        }
+    }
+
+    std::vector<std::pair<uint32_t, bool>> changes;
+    choker.update(candidates, pm->getLeftBytes() == 0, now, changes);
+
+    std::unordered_set<Loop*> touched;
+    for (const auto& change : changes) {
+        Loop* loop = owners[change.first];
+        std::lock_guard<std::mutex> lock(loop->pending_mutex);
+        loop->chokes.push_back(change);
+        touched.insert(loop);
+    }
+    for (Loop* loop : touched) wake(*loop);
+}
+
+void Reactor::acceptPending(Loop& loop) {
+    std::vector<Peer> batch;
+    std::vector<std::pair<int, Peer>> accepted;
+    {
+        std::lock_guard<std::mutex> lock(loop.pending_mutex);
+        batch.swap(loop.pending);
+        accepted.swap(loop.incoming);
+    }
+
+    for (const auto& peer : batch) {
+        auto e = std::make_unique<Entry>();
+        e->key = peerKey(peer.ip, peer.port);
+        e->pc = std::make_unique<PeerConnection>(peer.ip, peer.port, pm);
+        if (!e->pc->connectToPeer()) {
+            std::lock_guard<std::mutex> lock(active_mutex);
+            active_peers.erase(e->key);
+            active_count--;
+            continue;
+        }
+        registerConnection(loop, std::move(e));
+    }
+
+    // Un solo torrent: l'info-hash e' noto, il nostro handshake parte subito
+    // senza aspettare quello del peer
+    for (const auto& [fd, peer] : accepted) {
+        auto e = std::make_unique<Entry>();
+        e->key = peerKey(peer.ip, peer.port);
+        e->pc = std::make_unique<PeerConnection>(peer.ip, peer.port, pm);
+        e->pc->acceptFrom(fd);
+        registerConnection(loop, std::move(e));
+    }
+}
+
+bool Reactor::registerConnection(Loop& loop, std::unique_ptr<Entry> e) {
+    e->pc->sendHandshake(infoHash, myId);
+
+    struct epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP;
+    ev.data.ptr = e.get();
+    if (epoll_ctl(loop.epfd, EPOLL_CTL_ADD, e->pc->getSocket(), &ev) != 0) {
+        std::lock_guard<std::mutex> lock(active_mutex);
+        active_peers.erase(e->key);
+        active_count--;
+        return false;
+    }
+    e->out_registered = true;
+
+    {
+        std::lock_guard<std::mutex> lock(active_mutex);
+        peer_loops[e->pc->getId()] = &loop;
+    }
+    loop.by_id[e->pc->getId()] = e.get();
+
+    e->idx = loop.conns.size();
+    loop.conns.push_back(std::move(e));
+    return true;
+}
+
+void Reactor::updateInterest(Loop& loop, Entry& e) {
+    bool want = e.pc->wantsWrite();
+    if (want == e.out_registered) return;
+
+    struct epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP | (want ? (uint32_t)EPOLLOUT : 0u);
+    ev.data.ptr = &e;
+    epoll_ctl(loop.epfd, EPOLL_CTL_MOD, e.pc->getSocket(), &ev);
+    e.out_registered = want;
+}
+
+void Reactor::closeConnection(Loop& loop, Entry* e) {
+    epoll_ctl(loop.epfd, EPOLL_CTL_DEL, e->pc->getSocket(), nullptr);
+    {
+        std::lock_guard<std::mutex> lock(active_mutex);
+        active_peers.erase(e->key);
+        peer_loops.erase(e->pc->getId());
+    }
+    {
+        std::lock_guard<std::mutex> lock(rates_mutex);
+        peer_rates.erase(e->pc->getId());
+    }
+    active_count--;
+    loop.by_id.erase(e->pc->getId());
+
+    size_t idx = e->idx;
+    if (idx != loop.conns.size() - 1) {
+        std::swap(loop.conns[idx], loop.conns.back());
+        loop.conns[idx]->idx = idx;
+    }
+    loop.conns.pop_back();
+}
+
+void Reactor::run(Loop& loop) {
+    const int MAX_EVENTS = 256;
+    const int TICK_MS = 250;
+    struct epoll_event events[MAX_EVENTS];
+    auto lastTick = std::chrono::steady_clock::now();
+
+    while (running.load()) {
+        int n = epoll_wait(loop.epfd, events, MAX_EVENTS, TICK_MS);
+        if (n < 0 && errno != EINTR) break;
+
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.ptr == &listen_fd) {
+                acceptIncoming();
+                continue;
+            }
+            Entry* e = static_cast<Entry*>(events[i].data.ptr);
+
+            if (e == nullptr) {
+                uint64_t val;
+                while (read(loop.wakefd, &val, sizeof(val)) > 0) {}
+                acceptPending(loop);
+                deliverCancels(loop);
+                deliverHaves(loop);
+                deliverChokes(loop);
+                continue;
+            }
+
+            uint32_t ev = events[i].events;
+            bool alive = true;
+
+            if (ev & EPOLLOUT) alive = e->pc->onWritable();
+            if (alive && (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) alive = e->pc->onReadable();
+
+            if (alive) {
+                updateInterest(loop, *e);
+            } else {
+                closeConnection(loop, e);
+            }
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastTick >= std::chrono::milliseconds(TICK_MS)) {
+            lastTick = now;
+            for (size_t i = loop.conns.size(); i-- > 0;) {
+                Entry* e = loop.conns[i].get();
+                if (e->pc->onTick(now)) updateInterest(loop, *e);
+                else closeConnection(loop, e);
+            }
+            publishRates(loop);
+            if (&loop == loops[0].get()) runChoker(now);
+        }
+    }
+}
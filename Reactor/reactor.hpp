@@ -0,0 +1,111 @@
+#ifndef REACTOR_HPP
+#define REACTOR_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <unordered_set>
+#include <unordered_map>
+#include "../TrackerClient/Tracker.hpp"
+#include "../PeerConnection/peerConnection.hpp"
+#include "../PieceManager/pieceManager.hpp"
+#include "choker.hpp"
+
+// Event loop epoll: ogni thread possiede un sottoinsieme delle connessioni
+// e ne guida la macchina a stati senza mai bloccarsi su un singolo peer.
+// Il socket in ascolto sta nel primo loop, che distribuisce le connessioni
+// accettate agli altri come quelle in uscita.
+// Il choker vede tutte le connessioni: i loop pubblicano a ogni tick le
+// velocita' dei propri peer, il primo loop decide e le variazioni tornano al
+// loop proprietario come i CANCEL.
+class Reactor {
+public:
+    // uploadSlots: peer sbloccati per tit-for-tat, oltre a quello ottimistico
+    Reactor(size_t numThreads, const std::string& infoHash, const std::string& myId, PieceManager* pm,
+            size_t uploadSlots = 4);
+    ~Reactor();
+
+    void start();
+    void stop();
+
+    // Accetta connessioni in ingresso su port, finche' i peer attivi sono meno
+    // di maxPeers; va chiamata prima di start()
+    bool listen(uint16_t port, size_t maxPeers);
+
+    bool addPeer(const Peer& peer);
+    bool isPeerActive(const Peer& peer) const;
+
+    // Consegna un CANCEL al thread che possiede la connessione del peer
+    void postCancel(uint32_t peerId, const PieceManager::BlockRequest& req);
+    // Accoda un HAVE per tutte le connessioni di ogni thread
+    void postHave(uint32_t index);
+    size_t activeCount() const { return active_count.load(); }
+
+private:
+    struct Entry {
+        std::unique_ptr<PeerConnection> pc;
+        std::string key;
+        size_t idx = 0;
+        bool out_registered = false;
+    };
+
+    struct Loop {
+        int epfd = -1;
+        int wakefd = -1;
+        std::thread t;
+        std::mutex pending_mutex;
+        std::vector<Peer> pending;
+        std::vector<std::pair<int, Peer>> incoming;      // socket gia' accettati
+        std::vector<std::pair<uint32_t, PieceManager::BlockRequest>> cancels;
+        std::vector<uint32_t> haves;
+        std::vector<std::pair<uint32_t, bool>> chokes;   // (peer, true = choke)
+        std::vector<std::unique_ptr<Entry>> conns;
+        std::unordered_map<uint32_t, Entry*> by_id;
+    };
+
+    void run(Loop& loop);
+    void acceptPending(Loop& loop);
+    // Solo nel thread del primo loop, che possiede listen_fd
+    void acceptIncoming();
+    bool registerConnection(Loop& loop, std::unique_ptr<Entry> e);
+    void deliverCancels(Loop& loop);
+    void deliverHaves(Loop& loop);
+    void deliverChokes(Loop& loop);
+    // Velocita' dei peer del loop nella tabella condivisa
+    void publishRates(Loop& loop);
+    // Solo nel thread del primo loop, l'unico che tocca choker
+    void runChoker(std::chrono::steady_clock::time_point now);
+    void wake(Loop& loop);
+    void updateInterest(Loop& loop, Entry& e);
+    void closeConnection(Loop& loop, Entry* e);
+
+    static std::string peerKey(const std::string& ip, uint16_t port);
+
+    std::string infoHash;
+    std::string myId;
+    PieceManager* pm;
+
+    std::vector<std::unique_ptr<Loop>> loops;
+    std::atomic<size_t> next_loop{0};
+    std::atomic<size_t> active_count{0};
+    std::atomic<bool> running{false};
+    int listen_fd = -1;
+    size_t max_incoming = 0;
+
+    mutable std::mutex active_mutex;
+    std::unordered_set<std::string> active_peers;
+    std::unordered_map<uint32_t, Loop*> peer_loops;
+
+    struct PeerRates {
+        Loop* loop;
+        Choker::Candidate candidate;
+    };
+    std::mutex rates_mutex;
+    std::unordered_map<uint32_t, PeerRates> peer_rates;  // solo connessioni ACTIVE
+    Choker choker;
+};
+
+#endif
@@ -0,0 +1,361 @@
+#include "diskIO.hpp"
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <algorithm>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Niente liburing: bastano le due syscall e le strutture del kernel
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+}
+
+static bool writeAll(int fd, const uint8_t* p, size_t n, long long offset) {
+    while (n > 0) {
+        ssize_t w = pwrite(fd, p, n, offset);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += w;
+        n -= w;
+        offset += w;
+    }
+    return true;
+}
+
+DiskIO::DiskIO(Storage& s, size_t fallbackThreads, Callback cb) : storage(s), onDone(std::move(cb)) {
+    // Con il backend mmap una scrittura e' gia' una memcpy: basta il pool
+    bool useRing = storage.backend() == Storage::Backend::FD && !std::getenv("TORRENT_NO_IO_URING");
+    if (useRing && _setupRing()) {
+        ops.resize(sq_entries);
+        active.resize(sq_entries + 1);
+        for (size_t i = sq_entries; i-- > 0;) free_ops.push_back(i);
+        for (size_t i = sq_entries + 1; i-- > 0;) free_active.push_back(i);
+
+        threads.emplace_back(&DiskIO::submitLoop, this);
+        threads.emplace_back(&DiskIO::reapLoop, this);
+    } else {
+        if (fallbackThreads == 0) fallbackThreads = 1;
+        for (size_t i = 0; i < fallbackThreads; ++i) {
+            threads.emplace_back(&DiskIO::workerLoop, this);
+        }
+    }
+}
+
+DiskIO::~DiskIO() {
+    stop();
+    _teardownRing();
+}
+
+void DiskIO::submit(uint32_t index, const uint8_t* data, size_t len) {
+    pending_bytes.fetch_add(len, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        queue.push_back({index, data, len});
+    }
+    cv.notify_one();
+}
+
+void DiskIO::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (stopping) return;
+        stopping = true;
+    }
+    cv.notify_all();
+    for (auto& t : threads) {
+        if (t.joinable()) t.join();
+    }
+}
+
+bool DiskIO::_setupRing() {
+    struct io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+    int fd = sys_io_uring_setup(RING_ENTRIES, &p);
+    if (fd < 0) return false;
+    ring_fd = fd;
+
+    sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) sq_map_len = cq_map_len = std::max(sq_map_len, cq_map_len);
+
+    sq_ptr = mmap(nullptr, sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) {
+        sq_ptr = nullptr;
+        _teardownRing();
+        return false;
+    }
+
+    if (single) {
+        cq_ptr = sq_ptr;
+    } else {
+        cq_ptr = mmap(nullptr, cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq_ptr == MAP_FAILED) {
+            cq_ptr = nullptr;
+            _teardownRing();
+            return false;
+        }
+    }
+
+    sqes_map_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ptr = mmap(nullptr, sqes_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes_ptr == MAP_FAILED) {
+        sqes_ptr = nullptr;
+        _teardownRing();
+        return false;
+    }
+
+    char* sq = static_cast<char*>(sq_ptr);
+    char* cq = static_cast<char*>(cq_ptr);
+    sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes = cq + p.cq_off.cqes;
+    sq_entries = p.sq_entries;
+    return true;
+}
+
+void DiskIO::_teardownRing() {
+    if (sqes_ptr) munmap(sqes_ptr, sqes_map_len);
+    if (cq_ptr && cq_ptr != sq_ptr) munmap(cq_ptr, cq_map_len);
+    if (sq_ptr) munmap(sq_ptr, sq_map_len);
+    sqes_ptr = cq_ptr = sq_ptr = nullptr;
+    if (ring_fd >= 0) close(ring_fd);
+    ring_fd = -1;
+}
+
+void DiskIO::_queueWrite(Op& op, uint64_t tag) {
+    unsigned tail = *sq_tail;
+    unsigned idx = tail & *sq_mask;
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(sqes_ptr) + idx;
+    std::memset(sqe, 0, sizeof(*sqe));
+
+    // WRITEV c'e' da 5.1; l'iovec vive in ops fino al completamento
+    op.iov.iov_base = const_cast<uint8_t*>(op.data);
+    op.iov.iov_len = op.len;
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = op.fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&op.iov);
+    sqe->len = 1;
+    sqe->off = op.offset;
+    sqe->user_data = tag;
+
+    sq_array[idx] = idx;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+void DiskIO::_queueNop(uint64_t tag) {
+    unsigned tail = *sq_tail;
+    unsigned idx = tail & *sq_mask;
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(sqes_ptr) + idx;
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_NOP;
+    sqe->user_data = tag;
+
+    sq_array[idx] = idx;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+void DiskIO::_enter(unsigned toSubmit) {
+    while (toSubmit > 0) {
+        int r = sys_io_uring_enter(ring_fd, toSubmit, 0, 0);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EBUSY) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::cerr << "\n[ERRORE] io_uring_enter: " << strerror(errno) << std::endl;
+            return;
+        }
+        toSubmit -= r;
+    }
+}
+
+// Un thread solo alimenta la SQ: le SQE di un pezzo partono insieme con una
+// sola io_uring_enter, e se la ring e' piena prima si svuota quella in attesa.
+void DiskIO::submitLoop() {
+    const uint32_t pieceLength = storage.metainfo().piece_length;
+
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) break;
+            job = queue.front();
+            queue.pop_front();
+        }
+
+        struct Span { size_t file; long long offset; size_t dataOffset; size_t len; };
+        std::vector<Span> spans;
+        storage.metainfo().forEachFileSpan((long long)job.index * pieceLength, job.len,
+                                           [&](size_t f, long long fileOffset, size_t dataOffset, size_t n) {
+            spans.push_back({f, fileOffset, dataOffset, n});
+        });
+
+        // Il posto si libera solo dopo la callback, che arriva dopo in_flight--:
+        // con pezzi piccoli si possono esaurire prima delle SQE
+        size_t slot;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [this] { return !free_active.empty(); });
+            slot = free_active.back();
+            free_active.pop_back();
+            active[slot].job = job;
+            active[slot].remaining = spans.size();
+            active[slot].ok = !spans.empty();
+        }
+        if (spans.empty()) {
+            _finish(slot);
+            continue;
+        }
+
+        unsigned queued = 0;
+        for (const Span& span : spans) {
+            size_t opIndex;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                if (in_flight >= sq_entries) {
+                    lock.unlock();
+                    _enter(queued);
+                    queued = 0;
+                    lock.lock();
+                    cv.wait(lock, [this] { return in_flight < sq_entries; });
+                }
+                in_flight++;
+                opIndex = free_ops.back();
+                free_ops.pop_back();
+                ops[opIndex] = {slot, span.file, -1, span.offset, job.data + span.dataOffset, span.len, {}};
+            }
+
+            int fd = storage.acquireFd(span.file);
+            if (fd < 0) {
+                _completeOp(opIndex, -errno);
+                continue;
+            }
+            {
+                // Il completamento lo legge sotto mtx: il passaggio per la ring non basta a TSan
+                std::lock_guard<std::mutex> lock(mtx);
+                ops[opIndex].fd = fd;
+            }
+            _queueWrite(ops[opIndex], opIndex);
+            queued++;
+        }
+        _enter(queued);
+    }
+
+    // Tutte le scritture concluse: il NOP sveglia il thread dei completamenti per l'ultima volta
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [this] { return in_flight == 0; });
+    }
+    _queueNop(STOP_TAG);
+    _enter(1);
+}
+
+void DiskIO::reapLoop() {
+    while (true) {
+        int r = sys_io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+        if (r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            std::cerr << "\n[ERRORE] io_uring_enter: " << strerror(errno) << std::endl;
+        }
+
+        bool stop = false;
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            const struct io_uring_cqe* cqe = static_cast<const struct io_uring_cqe*>(cqes) + (head & *cq_mask);
+            uint64_t tag = cqe->user_data;
+            int res = cqe->res;
+            __atomic_store_n(cq_head, ++head, __ATOMIC_RELEASE);
+
+            if (tag == STOP_TAG) stop = true;
+            else _completeOp(tag, res);
+        }
+        if (stop) return;
+    }
+}
+
+void DiskIO::_completeOp(size_t opIndex, int res) {
+    Op op;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        op = ops[opIndex];
+    }
+
+    bool ok = true;
+    if (res < 0 && res != -EINTR && res != -EAGAIN) {
+        std::cerr << "\n[ERRORE] Scrittura fallita su: " << storage.metainfo().files[op.file].path
+                  << " (Errore: " << strerror(-res) << ")" << std::endl;
+        ok = false;
+    } else if ((size_t)std::max(res, 0) < op.len) {
+        // Scrittura parziale o da ripetere: il resto in modo sincrono
+        size_t done = std::max(res, 0);
+        ok = writeAll(op.fd, op.data + done, op.len - done, op.offset + done);
+    }
+    if (op.fd >= 0) {
+        // Solo ora: un flush() partito durante la scrittura non l'avrebbe coperta
+        storage.markDirty(op.file);
+        storage.releaseFd(op.file);
+    }
+
+    bool finished;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        free_ops.push_back(opIndex);
+        in_flight--;
+        Active& a = active[op.job];
+        a.ok = a.ok && ok;
+        finished = --a.remaining == 0;
+    }
+    cv.notify_all();
+    if (finished) _finish(op.job);
+}
+
+void DiskIO::_finish(size_t slot) {
+    Active a;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        a = active[slot];
+    }
+    pending_bytes.fetch_sub(a.job.len, std::memory_order_relaxed);
+    onDone(a.job.index, a.ok, a.job.data, a.job.len);
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        free_active.push_back(slot);
+    }
+    cv.notify_all();
+}
+
+void DiskIO::workerLoop() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            job = queue.front();
+            queue.pop_front();
+        }
+
+        bool ok = storage.writePiece(job.index, job.data, job.len);
+        pending_bytes.fetch_sub(job.len, std::memory_order_relaxed);
+        onDone(job.index, ok, job.data, job.len);
+    }
+}
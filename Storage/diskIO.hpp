@@ -0,0 +1,119 @@
+#ifndef DISKIO_HPP
+#define DISKIO_HPP
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <sys/uio.h>
+#include "storage.hpp"
+
+// Scritture dei pezzi verificati fuori dai thread di rete e di hash. Con
+// io_uring un thread prepara le SQE e un altro raccoglie i completamenti;
+// se il kernel non lo offre (o TORRENT_NO_IO_URING e' impostata), o se lo
+// Storage usa mmap, un pool di thread chiama Storage::writePiece. L'esito
+// arriva tramite la callback.
+class DiskIO {
+public:
+    using Callback = std::function<void(uint32_t index, bool ok, const uint8_t* data, size_t len)>;
+
+    DiskIO(Storage& storage, size_t fallbackThreads, Callback onDone);
+    ~DiskIO();
+
+    // data resta di proprieta' del chiamante e deve restare valido fino alla callback
+    void submit(uint32_t index, const uint8_t* data, size_t len);
+    // Attende che tutte le scritture in coda siano concluse, poi ferma i thread
+    void stop();
+
+    // Byte accodati o in scrittura: il PieceManager li usa per rallentare le richieste
+    size_t pendingBytes() const { return pending_bytes.load(std::memory_order_relaxed); }
+    const char* backendName() const {
+        if (ring_fd >= 0) return "io_uring";
+        return storage.backend() == Storage::Backend::MMAP ? "mmap" : "pwrite";
+    }
+
+private:
+    static constexpr unsigned RING_ENTRIES = 64;
+    static constexpr uint64_t STOP_TAG = ~0ULL;
+
+    struct Job {
+        uint32_t index;
+        const uint8_t* data;
+        size_t len;
+    };
+
+    // Una SQE: il tratto di un pezzo che cade in un singolo file
+    struct Op {
+        size_t job;
+        size_t file;
+        int fd;
+        long long offset;
+        const uint8_t* data;
+        size_t len;
+        struct iovec iov;
+    };
+
+    struct Active {
+        Job job;
+        uint32_t remaining = 0;
+        bool ok = true;
+    };
+
+    bool _setupRing();
+    void _teardownRing();
+    // Solo il thread di submit scrive nella SQ
+    void _queueWrite(Op& op, uint64_t tag);
+    void _queueNop(uint64_t tag);
+    void _enter(unsigned toSubmit);
+    void _completeOp(size_t opIndex, int res);
+    void _finish(size_t slot);
+
+    void submitLoop();
+    void reapLoop();
+    void workerLoop();
+
+    Storage& storage;
+    Callback onDone;
+
+    std::atomic<size_t> pending_bytes{0};
+
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<Job> queue;
+    bool stopping = false;
+    std::vector<std::thread> threads;
+
+    // Stato io_uring; ring_fd < 0 se si usa il pool di pwrite
+    int ring_fd = -1;
+    void* sq_ptr = nullptr;
+    void* cq_ptr = nullptr;
+    size_t sq_map_len = 0;
+    size_t cq_map_len = 0;
+    void* sqes_ptr = nullptr;
+    size_t sqes_map_len = 0;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    void* cqes = nullptr;
+    unsigned sq_entries = 0;
+
+    // Operazioni in volo, indicizzate dal user_data della SQE (protette da mtx).
+    // Al massimo sq_entries SQE in volo: la CQ, grande il doppio, non trabocca
+    // e i vettori non vengono mai riallocati.
+    std::vector<Op> ops;
+    std::vector<size_t> free_ops;
+    std::vector<Active> active;
+    std::vector<size_t> free_active;
+    size_t in_flight = 0;
+};
+
+#endif
@@ -0,0 +1,411 @@
+#include "storage.hpp"
+#include <iostream>
+#include <filesystem>
+#include <unordered_set>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/resource.h>
+
+Storage::Storage(const Metainfo& m, size_t maxOpenFiles, Backend backend) : meta(m), backend_type(backend) {
+    size_t cap = maxOpenFiles;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+        cap = std::min<size_t>(cap, std::max<size_t>(8, rl.rlim_cur / 4));
+    }
+    max_open = std::max<size_t>(1, cap);
+
+    fds.assign(meta.files.size(), -1);
+    users.assign(meta.files.size(), 0);
+    dirty.assign(meta.files.size(), 0);
+    lru_pos.resize(meta.files.size());
+}
+
+Storage::~Storage() {
+    stopPreallocation();
+
+    for (auto& entry : windows) {
+        munmap(entry.second.base, entry.second.len);
+    }
+    for (int fd : fds) {
+        if (fd >= 0) close(fd);
+    }
+}
+
+void Storage::stopPreallocation() {
+    prealloc_stop = true;
+    if (prealloc_thread.joinable()) prealloc_thread.join();
+}
+
+bool Storage::prepare(Preallocation mode) {
+    // La dimensione serve subito solo a mmap, che non puo' estendere il file scrivendo
+    bool keepSize = mode == Preallocation::KEEP_SIZE && backend_type == Backend::FD;
+
+    // Ogni cartella una volta sola, anche se contiene migliaia di file
+    std::unordered_set<std::string> dirs;
+    for (const FileInfo& file : meta.files) {
+        std::filesystem::path p(file.path);
+        if (p.has_parent_path()) dirs.insert(p.parent_path().string());
+    }
+    for (const std::string& dir : dirs) {
+        std::error_code ec;
+        std::filesystem::create_directories(dir, ec);
+        if (ec) {
+            std::cerr << "\n[ERRORE] Impossibile creare la cartella: " << dir << " (" << ec.message() << ")" << std::endl;
+            return false;
+        }
+    }
+
+    for (size_t f = 0; f < meta.files.size(); ++f) {
+        const FileInfo& file = meta.files[f];
+        int fd = open(file.path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            std::cerr << "\n[ERRORE] Impossibile creare il file: " << file.path << " (Errore: " << strerror(errno) << ")" << std::endl;
+            return false;
+        }
+
+        // File sparso della dimensione finale: le scritture non lo estendono piu'
+        struct stat st;
+        if (!keepSize && fstat(fd, &st) == 0 && st.st_size < file.length && ftruncate(fd, file.length) != 0) {
+            std::cerr << "\n[ERRORE] Impossibile dimensionare il file: " << file.path << " (Errore: " << strerror(errno) << ")" << std::endl;
+            close(fd);
+            return false;
+        }
+
+        // Scrivendo in una mappatura non c'e' un errore da controllare: se il disco
+        // si riempie arriva SIGBUS. Lo spazio va quindi riservato subito (se il
+        // filesystem non supporta fallocate si resta con il file sparso)
+        if (backend_type == Backend::MMAP && file.length > 0 &&
+            fallocate(fd, 0, 0, file.length) != 0 && errno != EOPNOTSUPP) {
+            std::cerr << "\n[ERRORE] Impossibile riservare lo spazio per: " << file.path << " (Errore: " << strerror(errno) << ")" << std::endl;
+            close(fd);
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mtx);
+        if (open_count < max_open) {
+            fds[f] = fd;
+            lru.push_front(f);
+            lru_pos[f] = lru.begin();
+            open_count++;
+        } else {
+            close(fd);
+        }
+    }
+
+    if (backend_type == Backend::FD && mode != Preallocation::SPARSE) {
+        prealloc_thread = std::thread(&Storage::_preallocate, this, keepSize ? FALLOC_FL_KEEP_SIZE : 0);
+    } else if (layout_handler) {
+        layout_handler();
+    }
+    return true;
+}
+
+// Tutti i file in un passaggio, in ordine: extent contigui per le letture
+// sequenziali e niente ENOSPC a sorpresa. Le scritture concorrenti non sono
+// un problema, fallocate non tocca i blocchi gia' allocati
+void Storage::_preallocate(int flags) {
+    // fallocate aggiorna anche mtime: l'handler va chiamato comunque alla fine
+    _preallocateFiles(flags);
+    if (!prealloc_stop && layout_handler) layout_handler();
+}
+
+void Storage::_preallocateFiles(int flags) {
+    for (size_t f = 0; f < meta.files.size() && !prealloc_stop; ++f) {
+        const FileInfo& file = meta.files[f];
+        if (file.length == 0) continue;
+
+        int fd = acquireFd(f);
+        if (fd < 0) {
+            std::cerr << "\n[ERRORE] Impossibile aprire il file: " << file.path << " (Errore: " << strerror(errno) << ")" << std::endl;
+            prealloc_failed = true;
+            return;
+        }
+
+        for (long long off = 0; off < file.length && !prealloc_stop; off += PREALLOC_CHUNK) {
+            long long n = std::min(PREALLOC_CHUNK, file.length - off);
+            if (fallocate(fd, flags, off, n) == 0) continue;
+            if (errno == EINTR) {
+                off -= PREALLOC_CHUNK;
+                continue;
+            }
+
+            // Filesystem senza fallocate: si resta con i file sparsi, come prima
+            bool unsupported = errno == EOPNOTSUPP;
+            if (!unsupported) {
+                std::cerr << "\n[ERRORE] Impossibile riservare lo spazio per: " << file.path << " (Errore: " << strerror(errno) << ")" << std::endl;
+                prealloc_failed = true;
+            }
+            releaseFd(f);
+            return;
+        }
+        releaseFd(f);
+    }
+}
+
+int Storage::acquireFd(size_t file) {
+    std::lock_guard<std::mutex> lock(mtx);
+
+    if (fds[file] >= 0) {
+        lru.splice(lru.begin(), lru, lru_pos[file]);
+        users[file]++;
+        return fds[file];
+    }
+
+    // Chiude i meno recenti non in uso; se sono tutti occupati si sfora di poco
+    for (auto it = lru.end(); open_count >= max_open && it != lru.begin();) {
+        --it;
+        if (users[*it] == 0) {
+            size_t victim = *it;
+            it = lru.erase(it);
+            close(fds[victim]);
+            fds[victim] = -1;
+            open_count--;
+        }
+    }
+
+    int fd = open(meta.files[file].path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) return -1;
+
+    fds[file] = fd;
+    lru.push_front(file);
+    lru_pos[file] = lru.begin();
+    open_count++;
+    users[file]++;
+    return fd;
+}
+
+void Storage::releaseFd(size_t file) {
+    std::lock_guard<std::mutex> lock(mtx);
+    users[file]--;
+}
+
+void Storage::markDirty(size_t file) {
+    std::lock_guard<std::mutex> lock(mtx);
+    dirty[file] = 1;
+}
+
+bool Storage::writePiece(uint32_t index, const uint8_t* data, size_t len) {
+    return write((long long)index * meta.piece_length, data, len);
+}
+
+bool Storage::write(long long offset, const uint8_t* data, size_t len) {
+    if (backend_type == Backend::MMAP) return _writeMapped(offset, data, len);
+
+    bool ok = true;
+    meta.forEachFileSpan(offset, len, [&](size_t f, long long fileOffset, size_t dataOffset, size_t n) {
+        if (!ok) return;
+
+        int fd = acquireFd(f);
+        if (fd < 0) {
+            std::cerr << "\n[ERRORE] Impossibile aprire il file: " << meta.files[f].path << " (Errore: " << strerror(errno) << ")" << std::endl;
+            ok = false;
+            return;
+        }
+
+        const uint8_t* p = data + dataOffset;
+        while (n > 0) {
+            ssize_t w = pwrite(fd, p, n, fileOffset);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                std::cerr << "\n[ERRORE] Scrittura fallita su: " << meta.files[f].path << " (Errore: " << strerror(errno) << ")" << std::endl;
+                ok = false;
+                break;
+            }
+            p += w;
+            n -= w;
+            fileOffset += w;
+        }
+        markDirty(f);
+        releaseFd(f);
+    });
+    return ok;
+}
+
+// Anche con mmap si legge con pread: la page cache e' la stessa, e sulle finestre
+// MADV_RANDOM una rilettura a freddo (la verifica all'avvio) procederebbe a pagine
+// da 4K invece che con il read-ahead del kernel
+bool Storage::read(long long offset, uint8_t* data, size_t len) {
+    bool ok = true;
+    meta.forEachFileSpan(offset, len, [&](size_t f, long long fileOffset, size_t dataOffset, size_t n) {
+        if (!ok) return;
+
+        int fd = acquireFd(f);
+        if (fd < 0) {
+            ok = false;
+            return;
+        }
+
+        uint8_t* p = data + dataOffset;
+        while (n > 0) {
+            ssize_t r = pread(fd, p, n, fileOffset);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) {
+                ok = false;
+                break;
+            }
+            p += r;
+            n -= r;
+            fileOffset += r;
+        }
+        releaseFd(f);
+    });
+    return ok;
+}
+
+// fdatasync copre anche le pagine sporcate attraverso le mappature MAP_SHARED:
+// non serve un msync per finestra, e vale anche per quelle gia' smappate
+bool Storage::flush() {
+    std::vector<size_t> toSync;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        for (size_t f = 0; f < dirty.size(); ++f) {
+            if (dirty[f]) {
+                toSync.push_back(f);
+                dirty[f] = 0;
+            }
+        }
+    }
+
+    bool ok = true;
+    for (size_t f : toSync) {
+        int fd = acquireFd(f);
+        if (fd < 0 || fdatasync(fd) != 0) {
+            std::cerr << "\n[ERRORE] Sincronizzazione fallita su: " << meta.files[f].path << " (Errore: " << strerror(errno) << ")" << std::endl;
+            ok = false;
+        }
+        if (fd >= 0) releaseFd(f);
+    }
+    return ok;
+}
+
+ssize_t Storage::sendTo(int sockfd, long long offset, size_t len) {
+    size_t file = 0;
+    long long fileOffset = -1;
+    size_t n = 0;
+    meta.forEachFileSpan(offset, len, [&](size_t f, long long fo, size_t, size_t span) {
+        if (fileOffset >= 0) return;
+        file = f;
+        fileOffset = fo;
+        n = span;
+    });
+    if (fileOffset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    int fd = acquireFd(file);
+    if (fd < 0) return -1;
+    off_t off = fileOffset;
+    ssize_t sent;
+    do {
+        sent = sendfile(sockfd, fd, &off, n);
+    } while (sent < 0 && errno == EINTR);
+    releaseFd(file);
+
+    // File piu' corto del previsto: nessun progresso possibile
+    if (sent == 0) {
+        errno = EIO;
+        return -1;
+    }
+    return sent;
+}
+
+void Storage::adviseSequential(long long offset, size_t len) {
+    meta.forEachFileSpan(offset, len, [&](size_t f, long long fileOffset, size_t, size_t n) {
+        int fd = acquireFd(f);
+        if (fd < 0) return;
+        posix_fadvise(fd, fileOffset, n, POSIX_FADV_SEQUENTIAL);
+        releaseFd(f);
+    });
+}
+
+bool Storage::_writeMapped(long long offset, const uint8_t* data, size_t len) {
+    bool ok = true;
+    meta.forEachFileSpan(offset, len, [&](size_t f, long long fileOffset, size_t dataOffset, size_t n) {
+        // Un tratto puo' attraversare il confine tra due finestre
+        while (ok && n > 0) {
+            size_t window = fileOffset / MAP_WINDOW;
+            size_t inWindow = fileOffset % MAP_WINDOW;
+            size_t windowLen;
+            uint8_t* base = _acquireWindow(f, window, windowLen);
+            if (!base) {
+                std::cerr << "\n[ERRORE] Impossibile mappare il file: " << meta.files[f].path << " (Errore: " << strerror(errno) << ")" << std::endl;
+                ok = false;
+                return;
+            }
+
+            size_t chunk = std::min(n, windowLen - inWindow);
+            std::memcpy(base + inWindow, data + dataOffset, chunk);
+            _releaseWindow(f, window);
+
+            fileOffset += chunk;
+            dataOffset += chunk;
+            n -= chunk;
+        }
+        if (ok) markDirty(f);
+    });
+    return ok;
+}
+
+uint8_t* Storage::_acquireWindow(size_t file, size_t window, size_t& windowLen) {
+    uint64_t key = _windowKey(file, window);
+    std::unique_lock<std::mutex> lock(mtx);
+
+    auto it = windows.find(key);
+    if (it != windows.end()) {
+        window_lru.splice(window_lru.begin(), window_lru, it->second.lru_pos);
+        it->second.users++;
+        windowLen = it->second.len;
+        return it->second.base;
+    }
+    lock.unlock();
+
+    // La mappatura sopravvive al descrittore, che torna subito alla cache
+    size_t start = window * MAP_WINDOW;
+    size_t len = std::min<size_t>(MAP_WINDOW, meta.files[file].length - start);
+    int fd = acquireFd(file);
+    if (fd < 0) return nullptr;
+    void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, start);
+    releaseFd(file);
+    if (p == MAP_FAILED) return nullptr;
+    // I pezzi arrivano in ordine di rarita': il read-ahead sui page fault sarebbe sprecato
+    madvise(p, len, MADV_RANDOM);
+
+    lock.lock();
+    it = windows.find(key);
+    if (it != windows.end()) {
+        // Un altro thread l'ha mappata nel frattempo
+        munmap(p, len);
+        window_lru.splice(window_lru.begin(), window_lru, it->second.lru_pos);
+        it->second.users++;
+        windowLen = it->second.len;
+        return it->second.base;
+    }
+
+    // Come per i descrittori: via le meno recenti non in uso
+    for (auto lit = window_lru.end(); windows.size() >= MAX_MAPPED_WINDOWS && lit != window_lru.begin();) {
+        --lit;
+        auto victim = windows.find(*lit);
+        if (victim->second.users == 0) {
+            munmap(victim->second.base, victim->second.len);
+            windows.erase(victim);
+            lit = window_lru.erase(lit);
+        }
+    }
+
+    window_lru.push_front(key);
+    windows[key] = {static_cast<uint8_t*>(p), len, 1, window_lru.begin()};
+    windowLen = len;
+    return static_cast<uint8_t*>(p);
+}
+
+void Storage::_releaseWindow(size_t file, size_t window) {
+    std::lock_guard<std::mutex> lock(mtx);
+    windows.find(_windowKey(file, window))->second.users--;
+}
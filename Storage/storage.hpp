@@ -0,0 +1,125 @@
+#ifndef STORAGE_HPP
+#define STORAGE_HPP
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+#include <sys/types.h>
+#include "../parser/Metainfo.hpp"
+
+// Accesso ai file del torrent per offset globale. I file vengono creati una
+// volta sola da prepare(); durante il download restano aperti al massimo
+// maxOpenFiles descrittori, chiusi in ordine LRU, e ogni scrittura e' una
+// pwrite all'offset calcolato senza seek.
+// Con il backend MMAP i file sono invece mappati a finestre di MAP_WINDOW
+// byte (anche i file enormi stanno nello spazio di indirizzi) e le scritture
+// diventano memcpy, senza una syscall per blocco.
+class Storage {
+public:
+    enum class Backend { FD, MMAP };
+    // SPARSE lascia i buchi; FULL e KEEP_SIZE riservano i blocchi con
+    // fallocate, KEEP_SIZE senza portare subito il file alla dimensione finale
+    enum class Preallocation { SPARSE, FULL, KEEP_SIZE };
+
+    // maxOpenFiles viene ridotto se supera una frazione di RLIMIT_NOFILE:
+    // i descrittori servono anche ai socket dei peer
+    Storage(const Metainfo& meta, size_t maxOpenFiles, Backend backend = Backend::FD);
+    ~Storage();
+
+    Storage(const Storage&) = delete;
+    Storage& operator=(const Storage&) = delete;
+
+    // Crea le cartelle in un solo passaggio e ogni file alla sua dimensione
+    // finale (tranne con KEEP_SIZE); la preallocazione prosegue poi in un
+    // thread mentre i peer si collegano. Con mmap lo spazio viene invece
+    // riservato subito, qualunque sia mode
+    bool prepare(Preallocation mode = Preallocation::SPARSE);
+    // Chiamato una volta quando i file hanno la loro forma definitiva: alla fine
+    // di prepare() o, se la preallocazione e' in background, quando termina.
+    // Da impostare prima di prepare(); puo' arrivare da un altro thread
+    using LayoutHandler = std::function<void()>;
+    void setLayoutHandler(LayoutHandler handler) { layout_handler = std::move(handler); }
+    // Interrompe la preallocazione e ne attende il thread: dopo il ritorno
+    // l'handler non viene piu' chiamato
+    void stopPreallocation();
+    // true se fallocate ha fallito (tipicamente ENOSPC): meglio fermarsi ora
+    // che a meta' download
+    bool preallocationFailed() const { return prealloc_failed.load(std::memory_order_relaxed); }
+
+    bool writePiece(uint32_t index, const uint8_t* data, size_t len);
+    bool write(long long offset, const uint8_t* data, size_t len);
+    bool read(long long offset, uint8_t* data, size_t len);
+    // Invia al socket fino a len byte dall'offset, dalla page cache al socket
+    // con sendfile e senza copie: si ferma alla fine del primo file o quando il
+    // socket e' pieno. Byte inviati, o -1 con errno (EAGAIN: socket pieno)
+    ssize_t sendTo(int sockfd, long long offset, size_t len);
+    // Letture sequenziali in arrivo sull'intervallo: il kernel raddoppia il
+    // read-ahead dei suoi file (POSIX_FADV_SEQUENTIAL)
+    void adviseSequential(long long offset, size_t len);
+    // Porta su disco quanto scritto finora (fdatasync dei file scritti)
+    bool flush();
+
+    Backend backend() const { return backend_type; }
+    const char* backendName() const { return backend_type == Backend::MMAP ? "mmap" : "fd"; }
+    size_t maxOpenFiles() const { return max_open; }
+    const Metainfo& metainfo() const { return meta; }
+
+    // Descrittore del file, aperto se serve (-1 in caso di errore); resta
+    // fissato nella cache, quindi valido, fino a releaseFd
+    int acquireFd(size_t file);
+    void releaseFd(size_t file);
+    // Segna il file da sincronizzare nel prossimo flush(). Va chiamata a
+    // scrittura terminata: un flush() concorrente ne azzera il segno prima
+    // dell'fdatasync, e una scrittura ancora in volo non sarebbe coperta
+    void markDirty(size_t file);
+
+private:
+    static constexpr size_t MAP_WINDOW = 64ULL * 1024 * 1024;
+    static constexpr size_t MAX_MAPPED_WINDOWS = 64;
+    static constexpr long long PREALLOC_CHUNK = 1LL << 30;
+
+    // Una finestra mappata di un file; users > 0 finche' una copia e' in corso
+    struct Window {
+        uint8_t* base;
+        size_t len;
+        uint32_t users;
+        std::list<uint64_t>::iterator lru_pos;
+    };
+
+    // Copia il buffer nel file passando dalle finestre mappate
+    bool _writeMapped(long long offset, const uint8_t* data, size_t len);
+    uint8_t* _acquireWindow(size_t file, size_t window, size_t& windowLen);
+    void _releaseWindow(size_t file, size_t window);
+    // Gira nel thread di preallocazione, un blocco di PREALLOC_CHUNK alla volta
+    void _preallocate(int flags);
+    void _preallocateFiles(int flags);
+    static uint64_t _windowKey(size_t file, size_t window) { return ((uint64_t)file << 32) | window; }
+
+    const Metainfo& meta;
+    size_t max_open;
+    Backend backend_type;
+
+    std::mutex mtx;
+    std::vector<int> fds;                       // -1 se chiuso
+    std::vector<uint32_t> users;                // operazioni in corso sul file
+    std::vector<uint8_t> dirty;                 // scritto dall'ultimo flush()
+    std::list<size_t> lru;                      // file aperti, i piu' recenti in testa
+    std::vector<std::list<size_t>::iterator> lru_pos;
+    size_t open_count = 0;
+
+    std::unordered_map<uint64_t, Window> windows;  // protetto da mtx
+    std::list<uint64_t> window_lru;
+
+    LayoutHandler layout_handler;
+    std::thread prealloc_thread;
+    std::atomic<bool> prealloc_stop{false};
+    std::atomic<bool> prealloc_failed{false};
+};
+
+#endif
@@ -1,5 +1,5 @@
 #include "Tracker.hpp"
-#include <../parser/TorrentFile.hpp>
+#include <cstring>
 #include <iostream>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -37,12 +37,13 @@ std::string TrackerClient::urlEncode(const std::string& binaryData) {
 }
 
 
-std::vector<Peer> TrackerClient::announce(const std::string& infoHash, const std::string& peerId, long long left, int listenPort, long long totalUploaded, long long totalDownloaded) {
+std::vector<Peer> TrackerClient::announce(const std::string& infoHash, const std::string& peerId, long long downloaded, long long left,
+                                          long long uploaded, int listenPort, AnnounceEvent event) {
     
     if (this->url.substr(0, 4) == "http") {
-        return announceHTTP(infoHash, peerId, left, listenPort, totalUploaded, totalDownloaded);
+        return announceHTTP(infoHash, peerId, downloaded, left, uploaded, listenPort, event);
     } else if (this->url.substr(0, 3) == "udp") {
-        return announceUDP(infoHash, peerId, left, listenPort, totalUploaded, totalDownloaded);
+        return announceUDP(infoHash, peerId, downloaded, left, uploaded, listenPort, event);
     }
 
     return {};
@@ -50,20 +51,27 @@ std::vector<Peer> TrackerClient::announce(const std::string& infoHash, const std
 }
 
 
-std::vector<Peer> TrackerClient::announceHTTP(const std::string& infoHash, const std::string& peerId, long long left, int listenPort, long long totalUploaded, long long totalDownloaded) {
+std::vector<Peer> TrackerClient::announceHTTP(const std::string& infoHash, const std::string& peerId, long long downloaded, long long left,
+                                              long long uploaded, int listenPort, AnnounceEvent event) {
     
-    cpr::Response r = cpr::Get(
-    cpr::Url{this->url},
-    cpr::Parameters{
+    cpr::Parameters params{
             {"info_hash",  infoHash}, 
             {"peer_id",    peerId},
             {"port",       std::to_string(listenPort)},
-            {"uploaded",   std::to_string(totalUploaded)},
-            {"downloaded", std::to_string(totalDownloaded)},
+            {"uploaded",   std::to_string(uploaded)},
+            {"downloaded", std::to_string(downloaded)},
             {"left",       std::to_string(left)},
             {"compact",    "1"},
             {"numwant",    "50"} 
-        },
+        };
+    // Gli announce periodici non hanno evento: il parametro si omette
+    if (event == AnnounceEvent::COMPLETED) params.Add({"event", "completed"});
+    else if (event == AnnounceEvent::STARTED) params.Add({"event", "started"});
+    else if (event == AnnounceEvent::STOPPED) params.Add({"event", "stopped"});
+
+    cpr::Response r = cpr::Get(
+    cpr::Url{this->url},
+    params,
     cpr::Timeout{15000}
     );
 
@@ -75,18 +83,42 @@ std::vector<Peer> TrackerClient::announceHTTP(const std::string& infoHash, const
 
     std::cout << "Risposta ricevuta dal Tracker!" << std::endl;
 
-    char* ptr = const_cast<char*>(r.text.c_str());
-    Bnode* root = TorrentFile::parse_element(ptr);
-
-    for (const auto& pair : root->dict_val){
-        
-        if (pair.first == "peers"){
-
-            return parseCompactPeers(pair.second->str_val);
+    // Servono solo "peers" (o "failure reason") del dizionario radice: la
+    // lettura si ferma appena li trova, senza costruire l'albero
+    struct AnnounceHandler {
+        std::string_view peers;
+        std::string_view failure;
+        bool found = false;
+
+        bool onInt(std::string_view, long long, int) { return true; }
+        bool onBegin(std::string_view, bool isDict, int depth) { return depth > 0 || isDict; }
+        bool onEnd(int) { return true; }
+        bool onString(std::string_view key, std::string_view value, int depth) {
+            if (depth != 1) return true;
+            if (key == "peers") {
+                peers = value;
+                found = true;
+                return false;
+            }
+            if (key == "failure reason") {
+                failure = value;
+                return false;
+            }
+            return true;
         }
+    } handler;
+
+    BencodeReader reader;
+    if (reader.read(r.text.data(), r.text.size(), handler) == BencodeReader::INVALID) {
+        std::cerr << "Risposta del Tracker non valida" << std::endl;
+        return {};
+    }
+    if (!handler.failure.empty()) {
+        std::cerr << "Il Tracker ha rifiutato l'announce: " << handler.failure << std::endl;
+        return {};
     }
 
-    delete root;
+    if (handler.found) return parseCompactPeers(handler.peers);
     return {};
 }
 
@@ -124,7 +156,8 @@ std::vector<Peer> TrackerClient::announceUDP(
     long long downloaded, 
     long long left, 
     long long uploaded, 
-    int event) 
+    int listenPort,
+    AnnounceEvent event) 
 {
     UDPTrackerInfo info = parseUDPUrl(this->url);
 
@@ -204,11 +237,11 @@ std::vector<Peer> TrackerClient::announceUDP(
     ann_req.uploaded   = htobe64(static_cast<uint64_t>(uploaded));
     
     
-    ann_req.event      = htonl(event);          
+    ann_req.event      = htonl(static_cast<uint32_t>(event));
     ann_req.ip_address = htonl(0);          
     ann_req.key        = htonl(std::rand());
     ann_req.num_want   = htonl(-1);         
-    ann_req.port       = htons(6881);       
+    ann_req.port       = htons(listenPort);
 
     sendto(sockfd, &ann_req, sizeof(ann_req), 0, res->ai_addr, res->ai_addrlen);
 
@@ -239,7 +272,7 @@ std::vector<Peer> TrackerClient::announceUDP(
     return listaPeer;
 }
 
-std::vector<Peer> TrackerClient::parseCompactPeers(const std::string& binaryPeers) {
+std::vector<Peer> TrackerClient::parseCompactPeers(std::string_view binaryPeers) {
 
     std::vector<Peer> peers;
     size_t numPeers = binaryPeers.size() / 6;
@@ -2,15 +2,20 @@
 #define TRACKERCLIENT_HPP
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <cstdint>
 #include <cpr/cpr.h>
-#include "../parser/Bnode.hpp"
+#include "../parser/BencodeReader.hpp"
 
 struct Peer {
     std::string ip;
     u_int16_t port;
 };
 
+// Evento dell'announce, con i valori del protocollo UDP
+enum class AnnounceEvent : uint32_t { NONE = 0, COMPLETED = 1, STARTED = 2, STOPPED = 3 };
+
 struct UDPTrackerInfo {
     std::string host;
     int port;
@@ -23,18 +28,22 @@ public:
 
     TrackerClient(const std::string& announceUrl);
     
-    std::vector<Peer> announce(const std::string& infoHash, const std::string& peerId, long long left, int listenPort, long long totalUploaded, long long totalDownloaded);
+    // listenPort: porta su cui i peer possono collegarsi a noi
+    std::vector<Peer> announce(const std::string& infoHash, const std::string& peerId, long long downloaded, long long left,
+                               long long uploaded, int listenPort, AnnounceEvent event = AnnounceEvent::NONE);
 
 private:
     std::string url;
     std::string urlEncode(const std::string& binaryData);
 
-    std::vector<Peer> announceHTTP(const std::string& infoHash, const std::string& peerId, long long left, int listenPort, long long totalUploaded, long long totalDownloaded);
+    std::vector<Peer> announceHTTP(const std::string& infoHash, const std::string& peerId, long long downloaded, long long left,
+                                   long long uploaded, int listenPort, AnnounceEvent event);
 
-    std::vector<Peer> announceUDP(const std::string& infoHash, const std::string& peerId, long long downloaded, long long left, long long uploaded, int event);
+    std::vector<Peer> announceUDP(const std::string& infoHash, const std::string& peerId, long long downloaded, long long left,
+                                  long long uploaded, int listenPort, AnnounceEvent event);
     UDPTrackerInfo parseUDPUrl(const std::string& url);
 
-    std::vector<Peer> parseCompactPeers(const std::string& binaryPeers);
+    std::vector<Peer> parseCompactPeers(std::string_view binaryPeers);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,172 @@
+// Confronto dei parser bencode su un .torrent: il vecchio parser a nodi
+// allocati uno per uno (copiato qui sotto cosi' com'era prima del DOM ad
+// arena), BencodeDocument e BencodeReader.
+// Uso: bencode_bench [file.torrent | numero di file]   (default: 20000 file sintetici)
+#include "Bnode.hpp"
+#include "BencodeReader.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <utility>
+#include <fstream>
+#include <iterator>
+#include <chrono>
+#include <algorithm>
+
+namespace legacy {
+
+struct Node {
+    Btype type;
+    long long int_val = 0;
+    std::string str_val;
+    std::vector<Node*> list_val;
+    std::vector<std::pair<std::string, Node*>> dict_val;
+
+    explicit Node(Btype t) : type(t) {}
+    ~Node() {
+        for (Node* n : list_val) delete n;
+        for (auto& p : dict_val) delete p.second;
+    }
+};
+
+Node* parse_element(const char*& ptr);
+
+Node* parse_int(const char*& ptr) {
+    Node* node = new Node(INTEGER);
+    const char* num_start = ++ptr;
+    while (*ptr != 'e') ++ptr;
+    node->int_val = std::stoll(std::string(num_start, ptr - num_start));
+    ++ptr;
+    return node;
+}
+
+Node* parse_string(const char*& ptr) {
+    Node* node = new Node(STRING);
+    const char* len_start = ptr;
+    while (*ptr != ':') ++ptr;
+    size_t len = std::stoull(std::string(len_start, ptr - len_start));
+    ++ptr;
+    node->str_val.assign(ptr, len);
+    ptr += len;
+    return node;
+}
+
+Node* parse_list(const char*& ptr) {
+    Node* node = new Node(LIST);
+    ++ptr;
+    while (*ptr != 'e') node->list_val.push_back(parse_element(ptr));
+    ++ptr;
+    return node;
+}
+
+Node* parse_dictionary(const char*& ptr) {
+    Node* node = new Node(DICTIONARY);
+    ++ptr;
+    while (*ptr != 'e') {
+        Node* key_node = parse_string(ptr);
+        std::string key = key_node->str_val;
+        delete key_node;
+        node->dict_val.push_back({key, parse_element(ptr)});
+    }
+    ++ptr;
+    return node;
+}
+
+Node* parse_element(const char*& ptr) {
+    switch (*ptr) {
+        case 'i': return parse_int(ptr);
+        case 'l': return parse_list(ptr);
+        case 'd': return parse_dictionary(ptr);
+        default:  return parse_string(ptr);
+    }
+}
+
+} // namespace legacy
+
+struct Counter {
+    size_t events = 0;
+    bool onInt(std::string_view, long long, int) { events++; return true; }
+    bool onString(std::string_view, std::string_view, int) { events++; return true; }
+    bool onBegin(std::string_view, bool, int) { events++; return true; }
+    bool onEnd(int) { events++; return true; }
+};
+
+static std::string bstr(const std::string& s) { return std::to_string(s.size()) + ":" + s; }
+
+// Torrent multi-file con nfiles voci in info/files e 20 byte di hash per pezzo
+static std::string synthetic(size_t nfiles) {
+    std::string files;
+    long long total = 0;
+    for (size_t i = 0; i < nfiles; i++) {
+        long long len = 1000 + (long long)(i * 7919 % 5000000);
+        total += len;
+        files += "d6:lengthi" + std::to_string(len) + "e4:pathl" + bstr("dir" + std::to_string(i % 97)) +
+                 bstr("file" + std::to_string(i) + ".bin") + "ee";
+    }
+    size_t npieces = (size_t)(total / 262144) + 1;
+    std::string pieces(npieces * 20, '\0');
+    for (size_t i = 0; i < pieces.size(); i++) pieces[i] = (char)(i * 2654435761u >> 13);
+
+    return "d8:announce" + bstr("udp://tracker.example.org:6969/announce") + "4:infod5:filesl" + files + "e" +
+           "4:name" + bstr("payload") + "12:piece lengthi262144e6:pieces" + bstr(pieces) + "ee";
+}
+
+template <typename F>
+static double best_seconds(int reps, F&& f) {
+    double best = 1e9;
+    for (int r = 0; r < reps; r++) {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    std::string data;
+    if (argc > 1 && std::strtoul(argv[1], nullptr, 10) == 0) {
+        std::ifstream file(argv[1], std::ios::binary);
+        if (!file) {
+            fprintf(stderr, "impossibile aprire %s\n", argv[1]);
+            return 1;
+        }
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    } else {
+        data = synthetic(argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000);
+    }
+
+    BencodeDocument check;
+    if (!check.parse(data.data(), data.size())) {
+        fprintf(stderr, "input bencode non valido\n");
+        return 1;
+    }
+
+    const int reps = 10;
+    double mib = data.size() / 1048576.0;
+    printf("input %.2f MiB (best of %d)\n", mib, reps);
+
+    double t = best_seconds(reps, [&] {
+        const char* ptr = data.data();
+        delete legacy::parse_element(ptr);
+    });
+    printf("  %-16s %8.2f ms %8.1f MiB/s\n", "legacy", t * 1e3, mib / t);
+
+    t = best_seconds(reps, [&] {
+        BencodeDocument doc;
+        doc.parse(data.data(), data.size());
+    });
+    printf("  %-16s %8.2f ms %8.1f MiB/s\n", "BencodeDocument", t * 1e3, mib / t);
+
+    BencodeReader::Limits limits;
+    limits.max_input = data.size();
+    limits.max_string = data.size();
+    size_t events = 0;
+    t = best_seconds(reps, [&] {
+        Counter counter;
+        BencodeReader(limits).read(data.data(), data.size(), counter);
+        events = counter.events;
+    });
+    printf("  %-16s %8.2f ms %8.1f MiB/s  (%zu eventi)\n", "BencodeReader", t * 1e3, mib / t, events);
+    return 0;
+}
@@ -0,0 +1,73 @@
+// Throughput of every SHA-1 compression backend on one large buffer, and of
+// hash_many with every lane engine on a batch of pieces.
+// Usage: sha1_bench [piece KiB] [pieces]   (defaults: 256 KiB, 256 pieces)
+#include "sha1.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+static const char *const backends[] = { "scalar", "ssse3", "avx2", "shani" };
+static const char *const lane_engines[] = { "single", "sse2x4", "avx2x8", "avx512x16" };
+
+template <typename F>
+static double best_seconds(int reps, F &&f){
+    double best = 1e9;
+    for (int r = 0; r < reps; r++){
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+    }
+    return best;
+}
+
+int main(int argc, char **argv){
+    size_t piece = (argc > 1 ? atol(argv[1]) : 256) * 1024;
+    size_t pieces = argc > 2 ? atol(argv[2]) : 256;
+    if (piece == 0 || pieces == 0){
+        fprintf(stderr, "usage: %s [piece KiB] [pieces]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<uint8_t> data(piece * pieces);
+    for (size_t i = 0; i < data.size(); i++) data[i] = (uint8_t)(i * 2654435761u >> 13);
+
+    printf("single stream, %zu MiB buffer (best of 15)\n", data.size() >> 20);
+    for (const char *backend : backends){
+        if (!sha1_engine::select_backend(backend)){
+            printf("  %-10s not supported\n", backend);
+            continue;
+        }
+        double t = best_seconds(15, [&]{
+            sha1 h;
+            h.add(data.data(), data.size());
+            h.finalize();
+        });
+        printf("  %-10s %6.0f MB/s\n", backend, data.size() / t / 1e6);
+    }
+
+    std::vector<const uint8_t*> ptrs(pieces);
+    std::vector<size_t> lens(pieces, piece);
+    std::vector<uint8_t> out(pieces * 20);
+    for (size_t i = 0; i < pieces; i++) ptrs[i] = data.data() + i * piece;
+
+    // scalar rounds keep every lane engine in use; with SHA-NI hash_many
+    // times both once and may hash one buffer at a time instead
+    auto run_many = [&](const char *label){
+        const char *name = sha1_engine::multi_backend_name();
+        double t = best_seconds(5, [&]{
+            sha1_engine::hash_many(ptrs.data(), lens.data(), pieces, reinterpret_cast<uint8_t (*)[20]>(out.data()));
+        });
+        printf("  %-16s %-10s %6.0f MB/s\n", label, name, data.size() / t / 1e6);
+    };
+    printf("hash_many, %zu pieces of %zu KiB (best of 5)\n", pieces, piece >> 10);
+    sha1_engine::select_backend("scalar");
+    for (const char *engine : lane_engines){
+        setenv("TORRENT_SHA1_MULTI", engine, 1);
+        run_many("compress=scalar");
+    }
+    unsetenv("TORRENT_SHA1_MULTI");
+    if (sha1_engine::select_backend("shani")) run_many("compress=shani");
+    return 0;
+}
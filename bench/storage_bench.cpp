@@ -0,0 +1,89 @@
+// Scrittura dei pezzi in ordine casuale con i due backend di Storage (pwrite
+// e file mappati), due thread come il fallback di DiskIO, a varie dimensioni
+// di pezzo; poi flush e rilettura.
+// Uso: storage_bench [MiB totali] [file] [directory]   (default: 1024 MiB, 4 file, /tmp)
+#include "../Storage/storage.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <filesystem>
+
+using Clock = std::chrono::steady_clock;
+
+static double ms(Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); }
+
+static void run(Storage::Backend backend, uint32_t pieceLength, long long total, size_t nfiles, const std::string& dir) {
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    Metainfo meta;
+    meta.piece_length = pieceLength;
+    meta.total_size = total;
+    meta.num_pieces = (uint32_t)((total + pieceLength - 1) / pieceLength);
+    long long offset = 0;
+    for (size_t i = 0; i < nfiles; i++) {
+        long long len = total / nfiles + (i == nfiles - 1 ? total % nfiles : 0);
+        meta.files.push_back({dir + "/f" + std::to_string(i), len});
+        meta.file_offsets.push_back(offset);
+        offset += len;
+    }
+    meta.file_offsets.push_back(offset);
+
+    std::vector<uint32_t> order(meta.num_pieces);
+    for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(1));
+    std::vector<uint8_t> piece(pieceLength, 0xab);
+
+    Storage storage(meta, 256, backend);
+    auto t0 = Clock::now();
+    if (!storage.prepare()) return;
+
+    auto t1 = Clock::now();
+    std::atomic<size_t> next{0};
+    auto writer = [&] {
+        size_t i;
+        while ((i = next++) < order.size()) storage.writePiece(order[i], piece.data(), meta.pieceSize(order[i]));
+    };
+    std::thread a(writer), b(writer);
+    a.join();
+    b.join();
+
+    auto t2 = Clock::now();
+    storage.flush();
+
+    auto t3 = Clock::now();
+    unsigned long long sum = 0;
+    for (uint32_t i = 0; i < meta.num_pieces; i++) {
+        storage.read((long long)i * pieceLength, piece.data(), meta.pieceSize(i));
+        sum += piece[0];
+    }
+    auto t4 = Clock::now();
+
+    printf("  %-4s %5u KiB  prepare %6.0f ms  write %6.0f ms  flush %6.0f ms  read %6.0f ms%s\n",
+           backend == Storage::Backend::MMAP ? "mmap" : "fd", pieceLength >> 10, ms(t1 - t0), ms(t2 - t1),
+           ms(t3 - t2), ms(t4 - t3), sum == (unsigned long long)meta.num_pieces * 0xab ? "" : "  (dati errati)");
+}
+
+int main(int argc, char** argv) {
+    long long total = (argc > 1 ? std::atoll(argv[1]) : 1024) << 20;
+    size_t nfiles = argc > 2 ? std::atol(argv[2]) : 4;
+    std::string dir = std::string(argc > 3 ? argv[3] : "/tmp") + "/storage_bench.d";
+    if (total <= 0 || nfiles == 0) {
+        fprintf(stderr, "uso: %s [MiB totali] [file] [directory]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%lld MiB in %zu file\n", total >> 20, nfiles);
+    for (uint32_t pieceLength : {16u << 10, 64u << 10, 256u << 10, 1u << 20, 4u << 20}) {
+        run(Storage::Backend::FD, pieceLength, total, nfiles, dir);
+        run(Storage::Backend::MMAP, pieceLength, total, nfiles, dir);
+    }
+    std::filesystem::remove_all(dir);
+    return 0;
+}
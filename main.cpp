@@ -3,6 +3,7 @@
 #include "TrackerClient/Tracker.hpp"
 #include "PeerConnection/peerConnection.hpp"
 #include "PieceManager/pieceManager.hpp"
+#include "Reactor/reactor.hpp"
 #include <iostream>
 #include <vector>
 #include <thread>
@@ -14,23 +15,23 @@
 #include <atomic>
 #include <memory>
 #include <random>         
+#include <cstdlib>
+#include <csignal>
 
-#define MAX_ACTIVE_PEERS 100 
+#define MAX_ACTIVE_PEERS 2000
+#define MAX_REACTOR_THREADS 4
+#define PIECE_MEMORY_BUDGET (256ULL * 1024 * 1024)
+#define MAX_OPEN_FILES 256
+#define UPLOAD_SLOTS 4
+#define LISTEN_PORT 6881
 
 
-struct ThreadControl {
-    std::thread t;
-    std::shared_ptr<std::atomic<bool>> finished;
-    Peer peer; 
-};
+// Ctrl-C o SIGTERM: il ciclo principale esce e i distruttori salvano lo stato.
+// A download completato e' l'unico modo di chiudere: fino ad allora si fa seed
+static std::atomic<bool> interrupted{false};
 
-bool isPeerActive(const std::vector<std::unique_ptr<ThreadControl>>& activeThreads, const Peer& p) {
-    for (const auto& tc : activeThreads) {
-        if (tc->peer.ip == p.ip && tc->peer.port == p.port) {
-            return true;
-        }
-    }
-    return false;
+static void onSignal(int) {
+    interrupted = true;
 }
 
 bool isPeerInPool(const std::deque<Peer>& pool, const Peer& p) {
@@ -42,18 +43,6 @@ bool isPeerInPool(const std::deque<Peer>& pool, const Peer& p) {
     return false;
 }
 
-void runPeer(Peer peer, std::string infoHash, std::string myId, PieceManager* pm, std::shared_ptr<std::atomic<bool>> finished) {
-    try {
-        PeerConnection pc(peer.ip, peer.port, &pm->rw_mutex, &pm->global_bitfield, pm);
-        if (pc.connectToPeer()) {
-            if (pc.sendHandshake(infoHash, myId) && pc.receiveHandshake(infoHash)) {
-                pc.startMessageLoop();
-            }
-        }
-    } catch (...) {}
-    *finished = true; 
-}
-
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         std::cout << "Uso: ./torrent_app <file.torrent>" << std::endl;
@@ -64,9 +53,39 @@ int main(int argc, char* argv[]) {
         TorrentFile torrent;
         if (!torrent.load(argv[1])) return 1;
 
+        const Metainfo& meta = torrent.getMetainfo();
         std::string infoHash = torrent.getInfoHashBinary();
         std::string myId = generateClientId();
-        PieceManager pm(torrent.getPiecesHash().length() / 20, torrent.getPieceLength(), torrent.getTotalSize());
+        size_t hashWorkers = std::max(1u, std::thread::hardware_concurrency() / 2);
+        bool hugePages = std::getenv("TORRENT_HUGEPAGES") != nullptr;
+
+        // Torrent con piu' file dei descrittori disponibili: TORRENT_MAX_OPEN_FILES abbassa il tetto
+        size_t maxOpenFiles = MAX_OPEN_FILES;
+        if (const char* env = std::getenv("TORRENT_MAX_OPEN_FILES")) maxOpenFiles = std::max(1L, std::atol(env));
+        // TORRENT_STORAGE=mmap scrive i pezzi in file mappati invece che con pwrite.
+        // Resta sperimentale: con bench/storage_bench la scrittura mappata e'
+        // piu' lenta di quella con fd a ogni dimensione di pezzo, da 16 KiB a 4 MiB
+        Storage::Backend storageBackend = Storage::Backend::FD;
+        if (const char* env = std::getenv("TORRENT_STORAGE")) {
+            if (std::string(env) == "mmap") storageBackend = Storage::Backend::MMAP;
+        }
+        // Spazio riservato in background; TORRENT_PREALLOCATE=keep lo riserva senza
+        // cambiare la dimensione dei file, =sparse lascia i file sparsi
+        Storage::Preallocation prealloc = Storage::Preallocation::FULL;
+        if (const char* env = std::getenv("TORRENT_PREALLOCATE")) {
+            if (std::string(env) == "keep") prealloc = Storage::Preallocation::KEEP_SIZE;
+            else if (std::string(env) == "sparse") prealloc = Storage::Preallocation::SPARSE;
+        }
+        // Peer sbloccati dal choker oltre all'ottimistico: TORRENT_UPLOAD_SLOTS per cambiarli
+        size_t uploadSlots = UPLOAD_SLOTS;
+        if (const char* env = std::getenv("TORRENT_UPLOAD_SLOTS")) uploadSlots = std::max(0L, std::atol(env));
+        // Porta per le connessioni in ingresso, annunciata al tracker: TORRENT_PORT per cambiarla
+        int listenPort = LISTEN_PORT;
+        if (const char* env = std::getenv("TORRENT_PORT")) listenPort = std::atoi(env);
+        Storage storage(meta, maxOpenFiles, storageBackend);
+
+        PieceManager pm(meta.num_pieces, meta.piece_length, meta.total_size, hashWorkers,
+                        PIECE_MEMORY_BUDGET, hugePages);
         
         std::stringstream ss;
         for(unsigned char c : infoHash) {
@@ -74,76 +93,91 @@ int main(int argc, char* argv[]) {
         }
         std::string infoHashHex = ss.str();
 
+        // Il registro va confrontato con i file prima che prepare() li tocchi;
+        // i pezzi da riverificare si controllano poi mentre i peer si collegano
         pm.setStateFile(infoHashHex);
+        pm.setMetainfo(&meta);
         pm.loadBitfield();
-        pm.saveBitfield(); 
 
-        pm.setPiecesHashes(torrent.getPiecesHash()); 
-        pm.setFilesList(torrent.getFilesList());
+        pm.setStorage(&storage);
+        if (!storage.prepare(prealloc)) return 1;
+        pm.restorePartials();
+        pm.startRecheck(std::max(1u, std::thread::hardware_concurrency()));
         
-        TrackerClient tracker(torrent.getAnnounceUrl());
+        TrackerClient tracker(meta.announce);
         
         std::random_device rd;
         std::mt19937 g(rd()); 
         
         std::deque<Peer> peerPool; 
-        std::vector<std::unique_ptr<ThreadControl>> activeThreads;
+
+        size_t numLoops = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), MAX_REACTOR_THREADS);
+        Reactor reactor(numLoops, infoHash, myId, &pm, uploadSlots);
+        // Senza ascolto si scarica comunque, ma solo dai peer che contattiamo noi
+        reactor.listen(listenPort, MAX_ACTIVE_PEERS);
+        reactor.start();
 
         long long downloaded = pm.getDownloadedBytes();
         long long left = pm.getLeftBytes();
 
         
-        std::vector<Peer> initialPeers = tracker.announce(infoHash, myId, downloaded, left, 0, 6881);
+        std::vector<Peer> initialPeers = tracker.announce(infoHash, myId, downloaded, left, pm.getUploadedBytes(), listenPort);
         
         
         std::shuffle(initialPeers.begin(), initialPeers.end(), g);
         for(const auto& p : initialPeers) peerPool.push_back(p);
 
         auto startTime = std::chrono::steady_clock::now();
-        std::cout << "Download avviato per: " << argv[1] << "\n" << std::endl;
+        std::cout << "Download avviato per: " << argv[1] << " (SHA-1: " << sha1_engine::backend_name() << ", bitfield: " << bitfield_ops::backend_name() << ", disco: " << pm.diskBackend() << ")\n" << std::endl;
 
         
         long long lastBytes = pm.getTotalTransferred();
         auto lastTime = std::chrono::steady_clock::now();
+        // Solo un download concluso in questa sessione si annuncia come completed
+        bool seeding = pm.getLeftBytes() == 0;
+        if (seeding) {
+            std::cout << "File gia' completi, in seed sulla porta " << listenPort << " (Ctrl-C per uscire)" << std::endl;
+            lastBytes = pm.getUploadedBytes();
+        }
 
-        while (pm.getLeftBytes() > 0) {
-            
-            
-            activeThreads.erase(std::remove_if(activeThreads.begin(), activeThreads.end(),
-                [](const std::unique_ptr<ThreadControl>& tc) {
-                    if (tc->finished->load()) { 
-                        if (tc->t.joinable()) tc->t.join(); 
-                        return true;
-                    }
-                    return false; 
-                }), 
-                activeThreads.end());
+        std::signal(SIGINT, onSignal);
+        std::signal(SIGTERM, onSignal);
 
+        while (!interrupted) {
+            if (storage.preallocationFailed()) {
+                std::cerr << "\n[ERRORE] Preallocazione dei file fallita, download interrotto" << std::endl;
+                reactor.stop();
+                return 1;
+            }
             
-            while (activeThreads.size() < MAX_ACTIVE_PEERS && !peerPool.empty()) {
+            while (reactor.activeCount() < MAX_ACTIVE_PEERS && !peerPool.empty()) {
                 Peer candidate = peerPool.front();
                 peerPool.pop_front();
 
-                
-                if (isPeerActive(activeThreads, candidate)) {
-                    continue;
-                }
-
-                auto tc = std::make_unique<ThreadControl>();
-                tc->finished = std::make_shared<std::atomic<bool>>(false);
-                tc->peer = candidate; 
-                tc->t = std::thread(runPeer, candidate, infoHash, myId, &pm, tc->finished);
-                activeThreads.push_back(std::move(tc));
+                reactor.addPeer(candidate);
             }
 
             
-            downloaded = pm.getDownloadedBytes();
+            if (!seeding && pm.getLeftBytes() == 0) {
+                seeding = true;
+                std::cout << "\n\nDownload completato! In seed sulla porta " << listenPort << " (Ctrl-C per uscire)" << std::endl;
+                // Completato dalla sola riverifica dei file: nulla e' stato scaricato
+                AnnounceEvent event = pm.getTotalTransferred() > 0 ? AnnounceEvent::COMPLETED : AnnounceEvent::NONE;
+                tracker.announce(infoHash, myId, pm.getDownloadedBytes(), 0, pm.getUploadedBytes(), listenPort, event);
+                lastBytes = pm.getUploadedBytes();
+                lastTime = std::chrono::steady_clock::now();
+            }
+
+            // Una sola lettura coerente per riga di stato
+            PieceManager::Stats stats = pm.getStats();
+            downloaded = stats.verified;
             double progress = (static_cast<double>(downloaded) / pm.total_size) * 100.0;
             
             // Velocità istantanea precisa
             auto currentTime = std::chrono::steady_clock::now();
             std::chrono::duration<double> dt = currentTime - lastTime;
-            long long currentTotal = pm.getTotalTransferred();
+            // In seed conta la velocita' di invio
+            long long currentTotal = seeding ? pm.getUploadedBytes() : stats.transferred;
             
             double speed = 0.0;
             if (dt.count() >= 1.0) { 
@@ -158,8 +192,8 @@ int main(int argc, char* argv[]) {
             std::cout << "\r[" 
                       << std::fixed << std::setprecision(2) << progress << "%] "
                       << "MB: " << downloaded / (1024 * 1024) << " / " << pm.total_size / (1024 * 1024) << " | "
-                      << "Peer: " << activeThreads.size() << " (Coda: " << peerPool.size() << ") | "
-                      << "Vel: ";
+                      << "Peer: " << reactor.activeCount() << " (Coda: " << peerPool.size() << ") | "
+                      << (seeding ? "Invio: " : "Vel: ");
 
             if (speed > 1024.0) {
                 std::cout << std::setprecision(2) << (speed / 1024.0) << " MB/s    ";
@@ -169,18 +203,17 @@ int main(int argc, char* argv[]) {
             std::cout << std::flush;
 
             
-            if (peerPool.size() < 10 || activeThreads.size() < 5) {
-                downloaded = pm.getDownloadedBytes();
-                left = pm.getLeftBytes();
+            if (peerPool.size() < 10 || reactor.activeCount() < 5) {
+                left = pm.total_size - downloaded;
                 
-                auto newPeers = tracker.announce(infoHash, myId, downloaded, left, 0, 6881);
+                auto newPeers = tracker.announce(infoHash, myId, downloaded, left, pm.getUploadedBytes(), listenPort);
                 
                 
                 std::shuffle(newPeers.begin(), newPeers.end(), g);
 
                 for (const auto& np : newPeers) {
                     
-                    if (!isPeerActive(activeThreads, np) && !isPeerInPool(peerPool, np)) {
+                    if (!reactor.isPeerActive(np) && !isPeerInPool(peerPool, np)) {
                         peerPool.push_back(np);
                     }
                 }
@@ -189,8 +222,10 @@ int main(int argc, char* argv[]) {
             std::this_thread::sleep_for(std::chrono::milliseconds(1000));
         }
 
-        std::cout << "\n\nDownload completato!" << std::endl;
-        for (auto& tc : activeThreads) if (tc->t.joinable()) tc->t.join();
+        if (seeding) std::cout << "\n\nSeed interrotto." << std::endl;
+        else std::cout << "\n\nDownload interrotto, salvataggio dello stato..." << std::endl;
+        reactor.stop();
+        storage.flush();
 
     } catch (const std::exception& e) {
         std::cerr << "\nErrore: " << e.what() << std::endl;
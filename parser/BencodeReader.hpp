@@ -0,0 +1,145 @@
+#ifndef BENCODEREADER_HPP
+#define BENCODEREADER_HPP
+
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+// Token elementari condivisi dal DOM (BencodeDocument) e dal lettore a eventi.
+// Tutti controllano i limiti del buffer e avanzano ptr solo in caso di successo.
+namespace bencode {
+
+    // Cifre decimali in [begin, end) senza segno; false se vuote o oltre limit
+    inline bool parseDigits(const char* begin, const char* end, unsigned long long limit, unsigned long long& out) {
+        if (begin == end) return false;
+        unsigned long long v = 0;
+        for (const char* p = begin; p < end; ++p) {
+            unsigned d = (unsigned char)*p - '0';
+            if (d > 9 || d > limit || v > (limit - d) / 10) return false;
+            v = v * 10 + d;
+        }
+        out = v;
+        return true;
+    }
+
+    // "i<numero>e"
+    inline bool readInt(const char*& ptr, const char* end, long long& out) {
+        if (ptr >= end || *ptr != 'i') return false;
+        const char* digits = ptr + 1;
+        const char* term = static_cast<const char*>(std::memchr(digits, 'e', end - digits));
+        if (!term) return false;
+
+        bool negative = digits < term && *digits == '-';
+        unsigned long long magnitude;
+        if (!parseDigits(digits + negative, term, (unsigned long long)INT64_MAX + negative, magnitude)) return false;
+
+        out = negative ? (long long)(0 - magnitude) : (long long)magnitude;
+        ptr = term + 1;
+        return true;
+    }
+
+    // "<lunghezza>:<byte>", al massimo maxLen byte
+    inline bool readString(const char*& ptr, const char* end, size_t maxLen, std::string_view& out) {
+        // La lunghezza ha al massimo 20 cifre: non serve cercare il ':' oltre
+        size_t window = std::min<size_t>(end - ptr, 21);
+        const char* colon = static_cast<const char*>(std::memchr(ptr, ':', window));
+        if (!colon) return false;
+
+        unsigned long long len;
+        const char* data = colon + 1;
+        if (!parseDigits(ptr, colon, std::min<unsigned long long>(end - data, maxLen), len)) return false;
+
+        out = std::string_view(data, len);
+        ptr = data + len;
+        return true;
+    }
+}
+
+// Lettore bencode a eventi per i dati che arrivano dalla rete (risposte dei
+// tracker, messaggi di estensione): nessuna allocazione, limiti rigidi su
+// profondita', lunghezza delle stringhe e dell'input.
+//
+// Il gestore riceve, per ogni valore, la chiave con cui compare nel
+// dizionario che lo contiene (vuota dentro le liste) e la profondita' del
+// contenitore (1 per le voci del dizionario radice). Restituendo false da
+// un evento la lettura si ferma subito: basta trovare la chiave cercata.
+//
+//   bool onInt(std::string_view key, long long value, int depth);
+//   bool onString(std::string_view key, std::string_view value, int depth);
+//   bool onBegin(std::string_view key, bool isDict, int depth);   // 'l' o 'd'
+//   bool onEnd(int depth);                                        // 'e', stessa depth di onBegin
+class BencodeReader {
+public:
+    static constexpr int MAX_DEPTH = 64;
+
+    struct Limits {
+        int max_depth = 16;
+        size_t max_string = 1 << 20;
+        size_t max_input = 4 << 20;
+    };
+
+    enum Status { DONE, STOPPED, INVALID };
+
+    BencodeReader() = default;
+    explicit BencodeReader(const Limits& l) : limits(l) {}
+
+    // Legge un solo valore dall'inizio di data; eventuali byte successivi sono ignorati
+    template <typename Handler>
+    Status read(const char* data, size_t len, Handler& handler) const {
+        if (len > limits.max_input) return INVALID;
+
+        const char* ptr = data;
+        const char* end = data + len;
+        int maxDepth = std::min(limits.max_depth, MAX_DEPTH);
+        bool inDict[MAX_DEPTH];
+        int depth = 0;
+
+        do {
+            std::string_view key;
+            if (depth > 0) {
+                if (ptr >= end) return INVALID;
+                if (*ptr == 'e') {
+                    ++ptr;
+                    --depth;
+                    if (!handler.onEnd(depth)) return STOPPED;
+                    continue;
+                }
+                if (inDict[depth - 1] && !bencode::readString(ptr, end, limits.max_string, key)) return INVALID;
+            }
+            if (ptr >= end) return INVALID;
+
+            switch (*ptr) {
+                case 'i': {
+                    long long value;
+                    if (!bencode::readInt(ptr, end, value)) return INVALID;
+                    if (!handler.onInt(key, value, depth)) return STOPPED;
+                    break;
+                }
+                case 'l':
+                case 'd': {
+                    if (depth >= maxDepth) return INVALID;
+                    bool isDict = *ptr == 'd';
+                    ++ptr;
+                    if (!handler.onBegin(key, isDict, depth)) return STOPPED;
+                    inDict[depth++] = isDict;
+                    break;
+                }
+                default: {
+                    std::string_view value;
+                    if (!bencode::readString(ptr, end, limits.max_string, value)) return INVALID;
+                    if (!handler.onString(key, value, depth)) return STOPPED;
+                    break;
+                }
+            }
+        } while (depth > 0);
+
+        return DONE;
+    }
+
+private:
+    Limits limits;
+};
+
+#endif
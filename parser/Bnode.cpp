@@ -1,12 +1,111 @@
 #include "Bnode.hpp"
+#include "BencodeReader.hpp"
+#include <algorithm>
+#include <cstring>
 
-Bnode::Bnode(Btype t) : type(t), int_val(0) {}
+const Bnode* Bnode::find(std::string_view k) const {
+    if (type != DICTIONARY) return nullptr;
+    const Bnode* it = std::lower_bound(begin(), end(), k,
+                                       [](const Bnode& n, std::string_view key) { return n.key < key; });
+    return (it != end() && it->key == k) ? it : nullptr;
+}
 
-Bnode::~Bnode() {
-    if (type == LIST) {
-        for (Bnode* node : list_val) delete node;
-    } 
-    else if (type == DICTIONARY) {
-        for (auto& pair : dict_val) delete pair.second;
+bool BencodeDocument::parse(const char* data, size_t len) {
+    arena.clear();
+    pending.clear();
+    root_node = nullptr;
+
+    const char* ptr = data;
+    if (!parseElement(ptr, data + len, 0)) {
+        arena.clear();
+        pending.clear();
+        return false;
+    }
+
+    root_node = store(&pending.back(), 1);
+    pending.clear();
+    return true;
+}
+
+const Bnode* BencodeDocument::store(const Bnode* nodes, size_t n) {
+    if (arena.empty() || arena.back().capacity() - arena.back().size() < n) {
+        size_t next = arena.empty() ? MIN_BLOCK_NODES : std::min(arena.back().capacity() * 2, MAX_BLOCK_NODES);
+        arena.emplace_back();
+        arena.back().reserve(std::max(next, n));
+    }
+
+    std::vector<Bnode>& block = arena.back();
+    size_t at = block.size();
+    block.insert(block.end(), nodes, nodes + n);
+    return block.data() + at;
+}
+
+bool BencodeDocument::parseElement(const char*& ptr, const char* end, int depth) {
+    if (ptr >= end) return false;
+
+    switch (*ptr) {
+        case 'i': return parseInt(ptr, end);
+        case 'l': return parseContainer(ptr, end, depth, LIST);
+        case 'd': return parseContainer(ptr, end, depth, DICTIONARY);
+        default: {
+            Bnode node(STRING);
+            node.raw_start = ptr;
+            if (!parseString(ptr, end, node.str_val)) return false;
+            node.raw_end = ptr;
+            pending.push_back(node);
+            return true;
+        }
     }
-}
\ No newline at end of file
+}
+
+bool BencodeDocument::parseInt(const char*& ptr, const char* end) {
+    Bnode node(INTEGER);
+    node.raw_start = ptr;
+    if (!bencode::readInt(ptr, end, node.int_val)) return false;
+    node.raw_end = ptr;
+    pending.push_back(node);
+    return true;
+}
+
+bool BencodeDocument::parseString(const char*& ptr, const char* end, std::string_view& out) {
+    return bencode::readString(ptr, end, SIZE_MAX, out);
+}
+
+bool BencodeDocument::parseContainer(const char*& ptr, const char* end, int depth, Btype type) {
+    if (depth >= MAX_DEPTH) return false;
+
+    const char* start = ptr++;
+    size_t base = pending.size();
+
+    while (true) {
+        if (ptr >= end) return false;
+        if (*ptr == 'e') break;
+
+        if (type == DICTIONARY) {
+            std::string_view key;
+            if (!parseString(ptr, end, key)) return false;
+            if (!parseElement(ptr, end, depth + 1)) return false;
+            pending.back().key = key;
+        } else {
+            if (!parseElement(ptr, end, depth + 1)) return false;
+        }
+    }
+    ++ptr;
+
+    auto first = pending.begin() + base;
+    if (type == DICTIONARY) {
+        // Lo standard vuole le chiavi gia' ordinate, ma non tutti i client lo rispettano
+        auto byKey = [](const Bnode& a, const Bnode& b) { return a.key < b.key; };
+        if (!std::is_sorted(first, pending.end(), byKey)) std::stable_sort(first, pending.end(), byKey);
+    }
+
+    Bnode node(type);
+    node.count = pending.size() - base;
+    node.children = store(pending.data() + base, node.count);
+    node.raw_start = start;
+    node.raw_end = ptr;
+
+    pending.erase(first, pending.end());
+    pending.push_back(node);
+    return true;
+}
@@ -3,23 +3,67 @@
 
 #include <vector>
 #include <string>
-#include <utility>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
 
 enum Btype { INTEGER, STRING, LIST, DICTIONARY };
 
+// Nodo del DOM bencode. Non possiede nulla: stringhe e chiavi sono viste nel
+// buffer letto, i figli stanno contigui nell'arena del BencodeDocument.
 struct Bnode {
     Btype type;
-    long long int_val;
-    std::string str_val;
-    
-    std::vector<Bnode*> list_val;
-    std::vector<std::pair<std::string, Bnode*>> dict_val;
+    long long int_val = 0;
+    std::string_view str_val;
 
-    char* raw_start = nullptr;
-    char* raw_end = nullptr;
+    // Chiave con cui il nodo compare nel dizionario padre (vuota altrimenti)
+    std::string_view key;
 
-    Bnode(Btype t);
-    ~Bnode();
+    // LIST: gli elementi; DICTIONARY: i valori, ordinati per chiave
+    const Bnode* children = nullptr;
+    uint32_t count = 0;
+
+    const char* raw_start = nullptr;
+    const char* raw_end = nullptr;
+
+    explicit Bnode(Btype t) : type(t) {}
+
+    const Bnode* begin() const { return children; }
+    const Bnode* end() const { return children + count; }
+
+    // Ricerca binaria sulle chiavi; nullptr se assente o se il nodo non e' un dizionario
+    const Bnode* find(std::string_view k) const;
+};
+
+// Arena dei nodi di un documento: blocchi di dimensione crescente che non si
+// spostano mai, i figli di un contenitore finiscono contigui nello stesso
+// blocco. Il buffer passato a parse deve restare valido finche' si usa il
+// documento.
+class BencodeDocument {
+public:
+    // false se l'input non e' bencode valido o supera i limiti di annidamento
+    bool parse(const char* data, size_t len);
+
+    const Bnode* root() const { return root_node; }
+
+private:
+    static constexpr int MAX_DEPTH = 256;
+    static constexpr size_t MIN_BLOCK_NODES = 256;
+    static constexpr size_t MAX_BLOCK_NODES = 65536;
+
+    // Copia n nodi contigui nell'arena e restituisce dove sono finiti
+    const Bnode* store(const Bnode* nodes, size_t n);
+
+    bool parseElement(const char*& ptr, const char* end, int depth);
+    bool parseInt(const char*& ptr, const char* end);
+    bool parseString(const char*& ptr, const char* end, std::string_view& out);
+    bool parseContainer(const char*& ptr, const char* end, int depth, Btype type);
+
+    // La capacita' di ogni blocco e' riservata in anticipo e mai superata
+    std::vector<std::vector<Bnode>> arena;
+    const Bnode* root_node = nullptr;
+    // Nodi gia' letti il cui contenitore non e' ancora chiuso
+    std::vector<Bnode> pending;
 };
 
-#endif
\ No newline at end of file
+#endif
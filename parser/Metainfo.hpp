@@ -0,0 +1,69 @@
+#ifndef METAINFO_HPP
+#define METAINFO_HPP
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+struct FileInfo {
+    std::string path;
+    long long length;
+};
+
+// Vista tipizzata del .torrent, calcolata una volta sola da TorrentFile::load.
+// piece_hashes punta nel buffer del TorrentFile che la contiene.
+struct Metainfo {
+    std::string announce;
+    std::string name;
+    long long total_size = 0;
+    uint32_t piece_length = 0;
+    uint32_t num_pieces = 0;
+
+    // 20 byte per pezzo, contigui
+    const uint8_t* piece_hashes = nullptr;
+
+    std::vector<FileInfo> files;
+    // file_offsets[i] = offset del file i nel torrent; l'ultimo elemento e' total_size
+    std::vector<long long> file_offsets;
+
+    const uint8_t* pieceHash(uint32_t index) const { return piece_hashes + (size_t)index * 20; }
+
+    uint32_t pieceSize(uint32_t index) const {
+        if (index + 1 < num_pieces) return piece_length;
+        return (uint32_t)(total_size - (long long)index * piece_length);
+    }
+
+    // File che contiene il byte offset (ricerca binaria, salta i file vuoti)
+    size_t fileAt(long long offset) const {
+        return std::upper_bound(file_offsets.begin(), file_offsets.end(), offset) - file_offsets.begin() - 1;
+    }
+
+    // Chiama fn(fileIndex, fileOffset, dataOffset, length) per ogni tratto di
+    // file coperto da [offset, offset + len) del torrent
+    template <typename Fn>
+    void forEachFileSpan(long long offset, size_t len, Fn&& fn) const {
+        if (len == 0 || offset < 0 || offset >= total_size) return;
+
+        size_t dataOffset = 0;
+        for (size_t f = fileAt(offset); f < files.size() && dataOffset < len; ++f) {
+            long long fileOffset = offset - file_offsets[f];
+            long long avail = files[f].length - fileOffset;
+            if (avail <= 0) continue;
+
+            size_t n = (size_t)std::min<long long>(avail, len - dataOffset);
+            fn(f, fileOffset, dataOffset, n);
+            dataOffset += n;
+            offset += n;
+        }
+    }
+
+    // Tratti di file di un pezzo intero
+    template <typename Fn>
+    void forEachPieceSpan(uint32_t index, Fn&& fn) const {
+        forEachFileSpan((long long)index * piece_length, pieceSize(index), fn);
+    }
+};
+
+#endif
@@ -5,10 +5,6 @@
 
 TorrentFile::TorrentFile() : root(nullptr) {}
 
-TorrentFile::~TorrentFile() {
-    if (root) delete root;
-}
-
 bool TorrentFile::load(const std::string& filePath) {
     std::ifstream file(filePath, std::ios::binary | std::ios::ate);
     if (!file.is_open()) return false;
@@ -18,101 +14,88 @@ bool TorrentFile::load(const std::string& filePath) {
     buffer.resize(size);
     if (!file.read(buffer.data(), size)) return false;
 
-    char* ptr = buffer.data();
-    root = parse_element(ptr);
+    if (!document.parse(buffer.data(), buffer.size()) || document.root()->type != DICTIONARY) {
+        std::cerr << "File .torrent non valido: " << filePath << std::endl;
+        root = nullptr;
+        return false;
+    }
+    root = document.root();
+    if (!buildMetainfo()) {
+        std::cerr << "Metadati del .torrent incompleti o incoerenti: " << filePath << std::endl;
+        return false;
+    }
     calculateInfoHash();
     return true;
 }
 
-
-Bnode* TorrentFile::parse_element(char* &ptr) {
-    switch (*ptr) {
-        case 'i': return parse_int(ptr);
-        case 'l': return parse_list(ptr);
-        case 'd': return parse_dictionary(ptr);
-        default:  return parse_string(ptr);
-    }
-}
-
-Bnode* TorrentFile::parse_int(char* &ptr) {
-    Bnode* node = new Bnode(INTEGER);
-    node->raw_start = ptr;
-    if (*ptr != 'i') throw std::runtime_error("Expected integer");
-    ++ptr; 
-
-    char* num_start = ptr;
-    while (*ptr != 'e') ++ptr;
-    node->int_val = std::stoll(std::string(num_start, ptr - num_start));
-
-    ++ptr; 
-    node->raw_end = ptr;
-    return node;
-}
-
-Bnode* TorrentFile::parse_string(char* &ptr) {
-    Bnode* node = new Bnode(STRING);
-    node->raw_start = ptr;
-
-    char* len_start = ptr;
-    while (*ptr != ':') ++ptr;
-    std::string len_str(len_start, ptr - len_start);
-    size_t len = std::stoull(len_str);
-
-    ++ptr; 
-    node->str_val.assign(ptr, len);
-    ptr += len;
-
-    node->raw_end = ptr;
-    return node;
-}
-
-Bnode* TorrentFile::parse_list(char* &ptr) {
-    Bnode* node = new Bnode(LIST);
-    node->raw_start = ptr;
-    ++ptr; 
-
-    while (*ptr != 'e') {
-        node->list_val.push_back(parse_element(ptr));
-    }
-
-    ++ptr; 
-    node->raw_end = ptr;
-    return node;
+bool TorrentFile::buildMetainfo() {
+    metainfo = Metainfo();
+
+    const Bnode* info = infoNode();
+    if (!info || info->type != DICTIONARY) return false;
+
+    if (const Bnode* announce = root->find("announce")) metainfo.announce = std::string(announce->str_val);
+    if (const Bnode* name = info->find("name")) metainfo.name = std::string(name->str_val);
+
+    const Bnode* pieceLength = info->find("piece length");
+    const Bnode* pieces = info->find("pieces");
+    if (!pieceLength || !pieces || pieces->type != STRING) return false;
+    if (pieceLength->int_val <= 0 || pieceLength->int_val > UINT32_MAX) return false;
+    if (pieces->str_val.size() % 20 != 0) return false;
+
+    metainfo.piece_length = (uint32_t)pieceLength->int_val;
+    metainfo.piece_hashes = reinterpret_cast<const uint8_t*>(pieces->str_val.data());
+
+    // File singolo: il nome e' il percorso. Multi-file: name e' la cartella radice
+    if (const Bnode* length = info->find("length")) {
+        metainfo.files.push_back({metainfo.name, length->int_val});
+    } else if (const Bnode* list = info->find("files")) {
+        metainfo.files.reserve(list->count);
+        for (const Bnode& fileDict : *list) {
+            long long len = 0;
+            std::string fullPath = metainfo.name;
+            if (const Bnode* length = fileDict.find("length")) len = length->int_val;
+            if (const Bnode* path = fileDict.find("path")) {
+                for (const Bnode& part : *path) {
+                    fullPath += '/';
+                    fullPath += part.str_val;
+                }
+            }
+            metainfo.files.push_back({fullPath, len});
+        }
+    } else {
+        return false;
+    }
+
+    metainfo.file_offsets.reserve(metainfo.files.size() + 1);
+    long long offset = 0;
+    for (const FileInfo& f : metainfo.files) {
+        if (f.length < 0) return false;
+        metainfo.file_offsets.push_back(offset);
+        offset += f.length;
+    }
+    metainfo.file_offsets.push_back(offset);
+    metainfo.total_size = offset;
+
+    // Un hash per pezzo, ne' uno in piu' ne' uno in meno. Un torrent vuoto non
+    // ha pezzi: bitfield, picker e stato in main presuppongono almeno un pezzo
+    long long expected = (offset + metainfo.piece_length - 1) / metainfo.piece_length;
+    if (offset == 0 || expected == 0) return false;
+    if ((long long)(pieces->str_val.size() / 20) != expected) return false;
+    metainfo.num_pieces = (uint32_t)expected;
+    return true;
 }
 
-Bnode* TorrentFile::parse_dictionary(char* &ptr) {
-    Bnode* node = new Bnode(DICTIONARY);
-    node->raw_start = ptr;
-    ++ptr; 
-
-    while (*ptr != 'e') {
-        Bnode* key_node = parse_string(ptr);
-        std::string key = key_node->str_val;
-        delete key_node;
-
-        node->dict_val.push_back({key, parse_element(ptr)});
-    }
-
-    ++ptr; 
-    node->raw_end = ptr;
-    return node;
-}
 
 void TorrentFile::calculateInfoHash() {
-    Bnode* infoNode = nullptr;
-    for (auto& pair : root->dict_val) {
-        if (pair.first == "info") {
-            infoNode = pair.second;
-            break;
-        }
-    }
+    const Bnode* info = infoNode();
 
-    if (infoNode && infoNode->raw_start && infoNode->raw_end) {
+    if (info && info->raw_start && info->raw_end) {
         sha1 checksum;
-        checksum.add(infoNode->raw_start, infoNode->raw_end - infoNode->raw_start);
+        checksum.add(info->raw_start, info->raw_end - info->raw_start);
         checksum.finalize();
 
-        
+
         uint8_t raw[20];
         for (int i = 0; i < 5; i++) {
 
@@ -137,95 +120,7 @@ std::string TorrentFile::getInfoHashBinary() const { return this->infoHashBinary
 void TorrentFile::printStructure() const { print_node(root, 0); }
 
 
-std::string TorrentFile::getAnnounceUrl() const {
-
-    for (const auto& pair : root->dict_val){
-        
-        if (pair.first == "announce"){
-
-            return pair.second->str_val;
-        }
-    }
-    return "";
-}
-
-
-long long TorrentFile::getTotalSize() const {
-
-    if (!root) return 0;
-
-    Bnode* infoNode = nullptr;
-
-    for(const auto& pair : root->dict_val){
-        if(pair.first == "info"){
-            infoNode = pair.second;
-            break;
-        }
-    }
-
-    if (!infoNode) return 0;
-
-    for (const auto& pair : infoNode->dict_val){
-
-        if (pair.first == "length"){
-            return pair.second->int_val;
-        }
-
-    }
-
-
-    long long totalSize = 0;
-
-    for (const auto& pair : infoNode->dict_val){
-
-        if (pair.first == "files"){
-
-            Bnode* filesList = pair.second;
-
-            for (Bnode* fileDict : filesList->list_val){
-
-                for (const auto& fPair : fileDict->dict_val){
-
-                    if (fPair.first == "length"){
-                        totalSize += fPair.second->int_val;
-                    }
-                }
-
-            }
-
-            return totalSize;
-        }
-    }
-
-    return 0;
-}
-
-
-std::string TorrentFile::getPiecesHash() const {
-    if (!root) return "";
-
-    Bnode* infoNode = nullptr;
-    for (const auto& pair : root->dict_val) {
-        if (pair.first == "info") {
-            infoNode = pair.second;
-            break;
-        }
-    }
-
-    if (!infoNode) return "";
-
-    for (const auto& pair : infoNode->dict_val) {
-        if (pair.first == "pieces") {
-            return pair.second->str_val;
-        }
-    }
-
-    return "";
-}
-
-
-
-void TorrentFile::print_node(Bnode* node, int indent) const {
+void TorrentFile::print_node(const Bnode* node, int indent) const {
     if (!node) return;
     std::string pad(indent * 2, ' ');
 
@@ -238,82 +133,14 @@ void TorrentFile::print_node(Bnode* node, int indent) const {
             break;
         case LIST:
             std::cout << pad << "list:" << '\n';
-            for (Bnode* child : node->list_val) print_node(child, indent + 1);
+            for (const Bnode& child : *node) print_node(&child, indent + 1);
             break;
         case DICTIONARY:
             std::cout << pad << "dict:" << '\n';
-            for (auto& kv : node->dict_val) {
-                std::cout << pad << "  key: " << kv.first << '\n';
-                print_node(kv.second, indent + 2);
+            for (const Bnode& child : *node) {
+                std::cout << pad << "  key: " << child.key << '\n';
+                print_node(&child, indent + 2);
             }
             break;
     }
 }
-
-long long TorrentFile::getPieceLength() const {
-
-    if (!root) return 0;
-
-    Bnode* infoNode = nullptr;
-
-    
-    for(const auto& pair : root->dict_val){
-        if(pair.first == "info"){
-            infoNode = pair.second;
-            break;
-        }
-    }
-
-    if (!infoNode) return 0;
-
-
-    for (const auto& pair : infoNode->dict_val){
-
-        if (pair.first == "piece length"){
-
-            return pair.second->int_val;
-        }
-
-    }
-
-    return 0;
-}
-
-
-std::vector<FileInfo> TorrentFile::getFilesList() const {
-    std::vector<FileInfo> files;
-    if (!root) return files;
-    Bnode* infoNode = nullptr;
-    for (const auto& pair : root->dict_val) {
-        if (pair.first == "info") { infoNode = pair.second; break; }
-    }
-    if (!infoNode) return files;
-
-    std::string rootName = "";
-    for (const auto& p : infoNode->dict_val) if (p.first == "name") rootName = p.second->str_val;
-
-    
-    for (const auto& p : infoNode->dict_val) {
-        if (p.first == "length") {
-            files.push_back({rootName, p.second->int_val});
-            return files;
-        }
-    }
-    
-    for (const auto& p : infoNode->dict_val) {
-        if (p.first == "files") {
-            for (Bnode* fileDict : p.second->list_val) {
-                long long len = 0;
-                std::string fullPath = rootName;
-                for (const auto& fPair : fileDict->dict_val) {
-                    if (fPair.first == "length") len = fPair.second->int_val;
-                    else if (fPair.first == "path") {
-                        for (Bnode* part : fPair.second->list_val) fullPath += "/" + part->str_val;
-                    }
-                }
-                files.push_back({fullPath, len});
-            }
-        }
-    }
-    return files;
-}
\ No newline at end of file
@@ -2,49 +2,53 @@
 #define TORRENTFILE_HPP
 
 #include "Bnode.hpp"
+#include "Metainfo.hpp"
 #include "sha1.hpp"
 #include <vector>
 #include <string>
-
-struct FileInfo {
-    std::string path;
-    long long length;
-};
+#include <string_view>
 
 class TorrentFile {
 public:
     TorrentFile();
-    ~TorrentFile();
+    // root e metainfo puntano dentro buffer
+    TorrentFile(const TorrentFile&) = delete;
+    TorrentFile& operator=(const TorrentFile&) = delete;
 
     bool load(const std::string& filePath);
 
     std::string getInfoHash() const;
     std::string getInfoHashBinary() const;
     
-    std::string getAnnounceUrl() const;
-    long long getTotalSize() const;
+    // Tutto cio' che serve a scaricare, valido finche' vive il TorrentFile
+    const Metainfo& getMetainfo() const { return metainfo; }
+
+    std::string getAnnounceUrl() const { return metainfo.announce; }
+    long long getTotalSize() const { return metainfo.total_size; }
 
-    long long getPieceLength() const;
+    long long getPieceLength() const { return metainfo.piece_length; }
 
-    std::string getPiecesHash() const;
+    std::string_view getPiecesHash() const {
+        return std::string_view(reinterpret_cast<const char*>(metainfo.piece_hashes), (size_t)metainfo.num_pieces * 20);
+    }
 
-    std::vector<FileInfo> getFilesList() const;
+    const std::vector<FileInfo>& getFilesList() const { return metainfo.files; }
 
     void printStructure() const;
 
-    static Bnode* parse_element(char* &ptr);
-    static Bnode* parse_int(char* &ptr);
-    static Bnode* parse_string(char* &ptr);
-    static Bnode* parse_list(char* &ptr);
-    static Bnode* parse_dictionary(char* &ptr);
 private:
-    Bnode* root;
+    // I nodi puntano dentro buffer: document e buffer vivono insieme
     std::vector<char> buffer;
+    BencodeDocument document;
+    const Bnode* root;
     std::string infoHash;
     std::string infoHashBinary;
+    Metainfo metainfo;
 
+    const Bnode* infoNode() const { return root ? root->find("info") : nullptr; }
+    bool buildMetainfo();
     void calculateInfoHash();
-    void print_node(Bnode* node, int indent) const;
+    void print_node(const Bnode* node, int indent) const;
 };
 
 #endif
\ No newline at end of file
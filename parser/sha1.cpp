@@ -0,0 +1,644 @@
+#include "sha1.hpp"
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SHA1_X86 1
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+namespace sha1_engine {
+
+static inline uint32_t rol32(uint32_t x, uint32_t n){
+    return (x << n) | (x >> (32 - n));
+}
+
+static inline uint32_t make_word(const uint8_t *p){
+    return
+        ((uint32_t)p[0] << 3*8) |
+        ((uint32_t)p[1] << 2*8) |
+        ((uint32_t)p[2] << 1*8) |
+        ((uint32_t)p[3] << 0*8);
+}
+
+void compress_scalar(uint32_t state[5], const uint8_t *ptr, size_t n_blocks){
+    const uint32_t c0 = 0x5a827999;
+    const uint32_t c1 = 0x6ed9eba1;
+    const uint32_t c2 = 0x8f1bbcdc;
+    const uint32_t c3 = 0xca62c1d6;
+
+    for (; n_blocks; n_blocks--, ptr += 64){
+        uint32_t a = state[0];
+        uint32_t b = state[1];
+        uint32_t c = state[2];
+        uint32_t d = state[3];
+        uint32_t e = state[4];
+
+        uint32_t w[16];
+
+        for (int i = 0; i < 16; i++) w[i] = make_word(ptr + i*4);
+
+#define SHA1_LOAD(i) w[i&15] = rol32(w[(i+13)&15] ^ w[(i+8)&15] ^ w[(i+2)&15] ^ w[i&15], 1);
+#define SHA1_ROUND_0(v,u,x,y,z,i)              z += ((u & (x ^ y)) ^ y) + w[i&15] + c0 + rol32(v, 5); u = rol32(u, 30);
+#define SHA1_ROUND_1(v,u,x,y,z,i) SHA1_LOAD(i) z += ((u & (x ^ y)) ^ y) + w[i&15] + c0 + rol32(v, 5); u = rol32(u, 30);
+#define SHA1_ROUND_2(v,u,x,y,z,i) SHA1_LOAD(i) z += (u ^ x ^ y) + w[i&15] + c1 + rol32(v, 5); u = rol32(u, 30);
+#define SHA1_ROUND_3(v,u,x,y,z,i) SHA1_LOAD(i) z += (((u | x) & y) | (u & x)) + w[i&15] + c2 + rol32(v, 5); u = rol32(u, 30);
+#define SHA1_ROUND_4(v,u,x,y,z,i) SHA1_LOAD(i) z += (u ^ x ^ y) + w[i&15] + c3 + rol32(v, 5); u = rol32(u, 30);
+
+        SHA1_ROUND_0(a, b, c, d, e,  0);
+        SHA1_ROUND_0(e, a, b, c, d,  1);
+        SHA1_ROUND_0(d, e, a, b, c,  2);
+        SHA1_ROUND_0(c, d, e, a, b,  3);
+        SHA1_ROUND_0(b, c, d, e, a,  4);
+        SHA1_ROUND_0(a, b, c, d, e,  5);
+        SHA1_ROUND_0(e, a, b, c, d,  6);
+        SHA1_ROUND_0(d, e, a, b, c,  7);
+        SHA1_ROUND_0(c, d, e, a, b,  8);
+        SHA1_ROUND_0(b, c, d, e, a,  9);
+        SHA1_ROUND_0(a, b, c, d, e, 10);
+        SHA1_ROUND_0(e, a, b, c, d, 11);
+        SHA1_ROUND_0(d, e, a, b, c, 12);
+        SHA1_ROUND_0(c, d, e, a, b, 13);
+        SHA1_ROUND_0(b, c, d, e, a, 14);
+        SHA1_ROUND_0(a, b, c, d, e, 15);
+        SHA1_ROUND_1(e, a, b, c, d, 16);
+        SHA1_ROUND_1(d, e, a, b, c, 17);
+        SHA1_ROUND_1(c, d, e, a, b, 18);
+        SHA1_ROUND_1(b, c, d, e, a, 19);
+        SHA1_ROUND_2(a, b, c, d, e, 20);
+        SHA1_ROUND_2(e, a, b, c, d, 21);
+        SHA1_ROUND_2(d, e, a, b, c, 22);
+        SHA1_ROUND_2(c, d, e, a, b, 23);
+        SHA1_ROUND_2(b, c, d, e, a, 24);
+        SHA1_ROUND_2(a, b, c, d, e, 25);
+        SHA1_ROUND_2(e, a, b, c, d, 26);
+        SHA1_ROUND_2(d, e, a, b, c, 27);
+        SHA1_ROUND_2(c, d, e, a, b, 28);
+        SHA1_ROUND_2(b, c, d, e, a, 29);
+        SHA1_ROUND_2(a, b, c, d, e, 30);
+        SHA1_ROUND_2(e, a, b, c, d, 31);
+        SHA1_ROUND_2(d, e, a, b, c, 32);
+        SHA1_ROUND_2(c, d, e, a, b, 33);
+        SHA1_ROUND_2(b, c, d, e, a, 34);
+        SHA1_ROUND_2(a, b, c, d, e, 35);
+        SHA1_ROUND_2(e, a, b, c, d, 36);
+        SHA1_ROUND_2(d, e, a, b, c, 37);
+        SHA1_ROUND_2(c, d, e, a, b, 38);
+        SHA1_ROUND_2(b, c, d, e, a, 39);
+        SHA1_ROUND_3(a, b, c, d, e, 40);
+        SHA1_ROUND_3(e, a, b, c, d, 41);
+        SHA1_ROUND_3(d, e, a, b, c, 42);
+        SHA1_ROUND_3(c, d, e, a, b, 43);
+        SHA1_ROUND_3(b, c, d, e, a, 44);
+        SHA1_ROUND_3(a, b, c, d, e, 45);
+        SHA1_ROUND_3(e, a, b, c, d, 46);
+        SHA1_ROUND_3(d, e, a, b, c, 47);
+        SHA1_ROUND_3(c, d, e, a, b, 48);
+        SHA1_ROUND_3(b, c, d, e, a, 49);
+        SHA1_ROUND_3(a, b, c, d, e, 50);
+        SHA1_ROUND_3(e, a, b, c, d, 51);
+        SHA1_ROUND_3(d, e, a, b, c, 52);
+        SHA1_ROUND_3(c, d, e, a, b, 53);
+        SHA1_ROUND_3(b, c, d, e, a, 54);
+        SHA1_ROUND_3(a, b, c, d, e, 55);
+        SHA1_ROUND_3(e, a, b, c, d, 56);
+        SHA1_ROUND_3(d, e, a, b, c, 57);
+        SHA1_ROUND_3(c, d, e, a, b, 58);
+        SHA1_ROUND_3(b, c, d, e, a, 59);
+        SHA1_ROUND_4(a, b, c, d, e, 60);
+        SHA1_ROUND_4(e, a, b, c, d, 61);
+        SHA1_ROUND_4(d, e, a, b, c, 62);
+        SHA1_ROUND_4(c, d, e, a, b, 63);
+        SHA1_ROUND_4(b, c, d, e, a, 64);
+        SHA1_ROUND_4(a, b, c, d, e, 65);
+        SHA1_ROUND_4(e, a, b, c, d, 66);
+        SHA1_ROUND_4(d, e, a, b, c, 67);
+        SHA1_ROUND_4(c, d, e, a, b, 68);
+        SHA1_ROUND_4(b, c, d, e, a, 69);
+        SHA1_ROUND_4(a, b, c, d, e, 70);
+        SHA1_ROUND_4(e, a, b, c, d, 71);
+        SHA1_ROUND_4(d, e, a, b, c, 72);
+        SHA1_ROUND_4(c, d, e, a, b, 73);
+        SHA1_ROUND_4(b, c, d, e, a, 74);
+        SHA1_ROUND_4(a, b, c, d, e, 75);
+        SHA1_ROUND_4(e, a, b, c, d, 76);
+        SHA1_ROUND_4(d, e, a, b, c, 77);
+        SHA1_ROUND_4(c, d, e, a, b, 78);
+        SHA1_ROUND_4(b, c, d, e, a, 79);
+
+#undef SHA1_LOAD
+#undef SHA1_ROUND_0
+#undef SHA1_ROUND_1
+#undef SHA1_ROUND_2
+#undef SHA1_ROUND_3
+#undef SHA1_ROUND_4
+
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+// Rounds fed by a precomputed W[t] + K[t] table; shared by the SIMD
+// message-schedule engines, which only vectorize the expansion. STRIDE is
+// the distance between groups of four words (8 when two blocks interleave).
+template <int STRIDE>
+__attribute__((always_inline))
+static inline void rounds_wk(uint32_t state[5], const uint32_t *wk){
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+    uint32_t e = state[4];
+
+#define SHA1_WK(i) wk[((i) >> 2) * STRIDE + ((i) & 3)]
+#define SHA1_WK_F0(v,u,x,y,z,i) z += ((u & (x ^ y)) ^ y) + SHA1_WK(i) + rol32(v, 5); u = rol32(u, 30);
+#define SHA1_WK_F1(v,u,x,y,z,i) z += (u ^ x ^ y) + SHA1_WK(i) + rol32(v, 5); u = rol32(u, 30);
+#define SHA1_WK_F2(v,u,x,y,z,i) z += (((u | x) & y) | (u & x)) + SHA1_WK(i) + rol32(v, 5); u = rol32(u, 30);
+#define SHA1_WK_5(F,i) F(a,b,c,d,e,i) F(e,a,b,c,d,i+1) F(d,e,a,b,c,i+2) F(c,d,e,a,b,i+3) F(b,c,d,e,a,i+4)
+#define SHA1_WK_20(F,i) SHA1_WK_5(F,i) SHA1_WK_5(F,i+5) SHA1_WK_5(F,i+10) SHA1_WK_5(F,i+15)
+
+    SHA1_WK_20(SHA1_WK_F0, 0)
+    SHA1_WK_20(SHA1_WK_F1, 20)
+    SHA1_WK_20(SHA1_WK_F2, 40)
+    SHA1_WK_20(SHA1_WK_F1, 60)
+
+#undef SHA1_WK
+#undef SHA1_WK_F0
+#undef SHA1_WK_F1
+#undef SHA1_WK_F2
+#undef SHA1_WK_5
+#undef SHA1_WK_20
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+}
+
+#ifdef SHA1_X86
+
+static const uint32_t K[4] = { 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6 };
+
+// The schedule lives in four registers holding W[t-16..t-1]. For each group
+// of four new words the last lane depends on the first one of the same
+// group, so it is patched with rol2 of the partial result (W[t+3] ^= rol2(x0)).
+#define SHA1_SCHEDULE_STEP(V, SRLI, SLLI, XOR, OR, ALIGNR, SL32, SR32, w0, w1, w2, w3) { \
+    V x = XOR(XOR(SRLI(w3, 4), w2), XOR(ALIGNR(w1, w0, 8), w0)); \
+    V r = OR(SL32(x, 1), SR32(x, 31)); \
+    V f = SLLI(x, 12); \
+    r = XOR(r, OR(SL32(f, 2), SR32(f, 30))); \
+    w0 = w1; w1 = w2; w2 = w3; w3 = r; }
+
+__attribute__((target("ssse3")))
+void compress_ssse3(uint32_t state[5], const uint8_t *ptr, size_t n_blocks){
+    const __m128i bswap = _mm_set_epi8(12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3);
+    alignas(16) uint32_t wk[80];
+
+    for (; n_blocks; n_blocks--, ptr += 64){
+        __m128i w0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(ptr + 0)), bswap);
+        __m128i w1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(ptr + 16)), bswap);
+        __m128i w2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(ptr + 32)), bswap);
+        __m128i w3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(ptr + 48)), bswap);
+
+        const __m128i k0 = _mm_set1_epi32((int)K[0]);
+        _mm_store_si128((__m128i*)(wk + 0), _mm_add_epi32(w0, k0));
+        _mm_store_si128((__m128i*)(wk + 4), _mm_add_epi32(w1, k0));
+        _mm_store_si128((__m128i*)(wk + 8), _mm_add_epi32(w2, k0));
+        _mm_store_si128((__m128i*)(wk + 12), _mm_add_epi32(w3, k0));
+
+        for (int t = 16; t < 80; t += 4){
+            SHA1_SCHEDULE_STEP(__m128i, _mm_srli_si128, _mm_slli_si128, _mm_xor_si128, _mm_or_si128,
+                               _mm_alignr_epi8, _mm_slli_epi32, _mm_srli_epi32, w0, w1, w2, w3)
+            _mm_store_si128((__m128i*)(wk + t), _mm_add_epi32(w3, _mm_set1_epi32((int)K[t / 20])));
+        }
+
+        rounds_wk<4>(state, wk);
+    }
+}
+
+// Two consecutive blocks share each 256-bit register (low lane block 0,
+// high lane block 1); the words are stored interleaved four by four.
+__attribute__((target("avx2")))
+void compress_avx2(uint32_t state[5], const uint8_t *ptr, size_t n_blocks){
+    const __m256i bswap = _mm256_set_epi8(12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3,
+                                          12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3);
+    alignas(32) uint32_t wk[160];
+
+    for (; n_blocks >= 2; n_blocks -= 2, ptr += 128){
+        __m256i w[4];
+        for (int j = 0; j < 4; j++){
+            __m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(ptr + j*16))),
+                                                _mm_loadu_si128((const __m128i*)(ptr + 64 + j*16)), 1);
+            w[j] = _mm256_shuffle_epi8(x, bswap);
+            _mm256_store_si256((__m256i*)(wk + j*8), _mm256_add_epi32(w[j], _mm256_set1_epi32((int)K[0])));
+        }
+        __m256i w0 = w[0], w1 = w[1], w2 = w[2], w3 = w[3];
+
+        for (int t = 16; t < 80; t += 4){
+            SHA1_SCHEDULE_STEP(__m256i, _mm256_srli_si256, _mm256_slli_si256, _mm256_xor_si256, _mm256_or_si256,
+                               _mm256_alignr_epi8, _mm256_slli_epi32, _mm256_srli_epi32, w0, w1, w2, w3)
+            _mm256_store_si256((__m256i*)(wk + t*2), _mm256_add_epi32(w3, _mm256_set1_epi32((int)K[t / 20])));
+        }
+
+        rounds_wk<8>(state, wk);
+        rounds_wk<8>(state, wk + 4);
+    }
+    if (n_blocks) compress_ssse3(state, ptr, n_blocks);
+}
+
+#undef SHA1_SCHEDULE_STEP
+
+// Intel SHA extensions: four rounds per sha1rnds4, schedule in sha1msg1/msg2.
+#define SHA1_NI_QUAD(EIN, EOUT, M0, M1, M2, M3, F) \
+    EIN = _mm_sha1nexte_epu32(EIN, M0); \
+    EOUT = abcd; \
+    M1 = _mm_sha1msg2_epu32(M1, M0); \
+    abcd = _mm_sha1rnds4_epu32(abcd, EIN, F); \
+    M3 = _mm_sha1msg1_epu32(M3, M0); \
+    M2 = _mm_xor_si128(M2, M0);
+
+__attribute__((target("sha,sse4.1")))
+void compress_shani(uint32_t state[5], const uint8_t *ptr, size_t n_blocks){
+    const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+    __m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1B);
+    __m128i e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+    __m128i e1;
+
+    for (; n_blocks; n_blocks--, ptr += 64){
+        __m128i abcd_save = abcd;
+        __m128i e0_save = e0;
+
+        __m128i m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(ptr + 0)), mask);
+        __m128i m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(ptr + 16)), mask);
+        __m128i m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(ptr + 32)), mask);
+        __m128i m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(ptr + 48)), mask);
+
+        // rounds 0-15: schedule still being primed
+        e0 = _mm_add_epi32(e0, m0);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+        e1 = _mm_sha1nexte_epu32(e1, m1);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+        m0 = _mm_sha1msg1_epu32(m0, m1);
+
+        e0 = _mm_sha1nexte_epu32(e0, m2);
+        e1 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+        m1 = _mm_sha1msg1_epu32(m1, m2);
+        m0 = _mm_xor_si128(m0, m2);
+
+        SHA1_NI_QUAD(e1, e0, m3, m0, m1, m2, 0)
+
+        // rounds 16-79
+        SHA1_NI_QUAD(e0, e1, m0, m1, m2, m3, 0)
+        SHA1_NI_QUAD(e1, e0, m1, m2, m3, m0, 1)
+        SHA1_NI_QUAD(e0, e1, m2, m3, m0, m1, 1)
+        SHA1_NI_QUAD(e1, e0, m3, m0, m1, m2, 1)
+        SHA1_NI_QUAD(e0, e1, m0, m1, m2, m3, 1)
+        SHA1_NI_QUAD(e1, e0, m1, m2, m3, m0, 1)
+        SHA1_NI_QUAD(e0, e1, m2, m3, m0, m1, 2)
+        SHA1_NI_QUAD(e1, e0, m3, m0, m1, m2, 2)
+        SHA1_NI_QUAD(e0, e1, m0, m1, m2, m3, 2)
+        SHA1_NI_QUAD(e1, e0, m1, m2, m3, m0, 2)
+        SHA1_NI_QUAD(e0, e1, m2, m3, m0, m1, 2)
+        SHA1_NI_QUAD(e1, e0, m3, m0, m1, m2, 3)
+        SHA1_NI_QUAD(e0, e1, m0, m1, m2, m3, 3)
+        SHA1_NI_QUAD(e1, e0, m1, m2, m3, m0, 3)
+        SHA1_NI_QUAD(e0, e1, m2, m3, m0, m1, 3)
+
+        e1 = _mm_sha1nexte_epu32(e1, m3);
+        e0 = abcd;
+        abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+        e0 = _mm_sha1nexte_epu32(e0, e0_save);
+        abcd = _mm_add_epi32(abcd, abcd_save);
+    }
+
+    _mm_storeu_si128((__m128i*)state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+#undef SHA1_NI_QUAD
+
+static bool cpu_has(const char *name){
+    unsigned int eax, ebx, ecx, edx;
+    __builtin_cpu_init();
+    if (strcmp(name, "shani") == 0){
+        if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return false;
+        return (ebx & (1u << 29)) && __builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("ssse3");
+    }
+    if (strcmp(name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+    if (strcmp(name, "ssse3") == 0) return __builtin_cpu_supports("ssse3");
+    return strcmp(name, "scalar") == 0;
+}
+
+#else
+
+void compress_ssse3(uint32_t state[5], const uint8_t *ptr, size_t n_blocks){ compress_scalar(state, ptr, n_blocks); }
+void compress_avx2(uint32_t state[5], const uint8_t *ptr, size_t n_blocks){ compress_scalar(state, ptr, n_blocks); }
+void compress_shani(uint32_t state[5], const uint8_t *ptr, size_t n_blocks){ compress_scalar(state, ptr, n_blocks); }
+
+static bool cpu_has(const char *name){
+    return strcmp(name, "scalar") == 0;
+}
+
+#endif
+
+// ---------------------------------------------------------------------------
+// Multi-buffer hashing: LANES independent messages advance together, one per
+// 32-bit lane. Each message is a run of whole blocks read in place followed by
+// one or two padded tail blocks built on the side.
+
+struct lane_msg {
+    const uint8_t *data;
+    size_t full_blocks;
+    size_t total_blocks;
+    uint8_t tail[128];
+};
+
+static void prepare_lane(lane_msg &m, const uint8_t *data, size_t len){
+    m.data = data;
+    m.full_blocks = len / 64;
+    size_t rest = len % 64;
+    size_t tail_len = rest + 9 <= 64 ? 64 : 128;
+    memset(m.tail, 0, sizeof(m.tail));
+    if (rest) memcpy(m.tail, data + m.full_blocks * 64, rest);
+    m.tail[rest] = 0x80;
+    uint64_t n_bits = (uint64_t)len * 8;
+    for (int j = 0; j < 8; j++) m.tail[tail_len - 1 - j] = (uint8_t)(n_bits >> j * 8);
+    m.total_blocks = m.full_blocks + tail_len / 64;
+}
+
+static inline const uint8_t *lane_block(const lane_msg &m, size_t k){
+    if (k < m.full_blocks) return m.data + k * 64;
+    if (k < m.total_blocks) return m.tail + (k - m.full_blocks) * 64;
+    return m.tail;
+}
+
+static void store_digest(const uint32_t st[5], uint8_t *out){
+    for (int i = 0; i < 5; i++){
+        out[i*4 + 0] = (st[i] >> 24) & 0xff;
+        out[i*4 + 1] = (st[i] >> 16) & 0xff;
+        out[i*4 + 2] = (st[i] >> 8) & 0xff;
+        out[i*4 + 3] = (st[i]) & 0xff;
+    }
+}
+
+template <typename V, int LANES>
+__attribute__((always_inline))
+static inline void compress_lanes(V *st, const uint8_t *const *blocks){
+    // transpose through a staging area: all scalar stores land before the
+    // first vector load, so the loads are not stalled on store forwarding
+    uint32_t stage[16][LANES];
+    for (int j = 0; j < LANES; j++){
+        for (int t = 0; t < 16; t++) stage[t][j] = make_word(blocks[j] + t*4);
+    }
+    V w[16];
+    memcpy(w, stage, sizeof(w));
+
+    V a = st[0], b = st[1], c = st[2], d = st[3], e = st[4];
+
+#define SHA1_LANE_ROUND(F, K, i) { \
+        V wi; \
+        if ((i) < 16) wi = w[(i) & 15]; \
+        else { wi = w[((i)+13)&15] ^ w[((i)+8)&15] ^ w[((i)+2)&15] ^ w[(i)&15]; wi = (wi << 1) | (wi >> 31); w[(i)&15] = wi; } \
+        V t = ((a << 5) | (a >> 27)) + (F) + e + (uint32_t)(K) + wi; \
+        e = d; d = c; c = (b << 30) | (b >> 2); b = a; a = t; }
+
+    for (int i = 0; i < 20; i++) SHA1_LANE_ROUND((b & (c ^ d)) ^ d, 0x5a827999, i)
+    for (int i = 20; i < 40; i++) SHA1_LANE_ROUND(b ^ c ^ d, 0x6ed9eba1, i)
+    for (int i = 40; i < 60; i++) SHA1_LANE_ROUND((b & c) | (d & (b | c)), 0x8f1bbcdc, i)
+    for (int i = 60; i < 80; i++) SHA1_LANE_ROUND(b ^ c ^ d, 0xca62c1d6, i)
+
+#undef SHA1_LANE_ROUND
+
+    st[0] += a; st[1] += b; st[2] += c; st[3] += d; st[4] += e;
+}
+
+// Runs up to LANES messages; unused lanes replay a dummy block.
+template <typename V, int LANES>
+__attribute__((always_inline))
+static inline void hash_lanes(lane_msg *msgs, size_t count, uint8_t (*digests)[20]){
+    V st[5];
+    const uint32_t init[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    for (int i = 0; i < 5; i++){
+        uint32_t tmp[LANES];
+        for (int j = 0; j < LANES; j++) tmp[j] = init[i];
+        memcpy(&st[i], tmp, sizeof(V));
+    }
+
+    size_t max_blocks = 0;
+    for (size_t j = 0; j < count; j++) if (msgs[j].total_blocks > max_blocks) max_blocks = msgs[j].total_blocks;
+
+    const uint8_t *blocks[LANES];
+    for (size_t k = 0; k < max_blocks; k++){
+        for (int j = 0; j < LANES; j++) blocks[j] = (size_t)j < count ? lane_block(msgs[j], k) : msgs[0].tail;
+        compress_lanes<V, LANES>(st, blocks);
+
+        for (size_t j = 0; j < count; j++){
+            if (msgs[j].total_blocks != k + 1) continue;
+            uint32_t lane_state[5];
+            for (int i = 0; i < 5; i++) lane_state[i] = st[i][j];
+            store_digest(lane_state, digests[j]);
+        }
+    }
+}
+
+#ifdef SHA1_X86
+
+typedef uint32_t v4u32 __attribute__((vector_size(16)));
+typedef uint32_t v8u32 __attribute__((vector_size(32)));
+typedef uint32_t v16u32 __attribute__((vector_size(64)));
+
+__attribute__((target("sse2")))
+static void hash_lanes_sse2(lane_msg *msgs, size_t count, uint8_t (*digests)[20]){
+    hash_lanes<v4u32, 4>(msgs, count, digests);
+}
+
+__attribute__((target("avx2")))
+static void hash_lanes_avx2(lane_msg *msgs, size_t count, uint8_t (*digests)[20]){
+    hash_lanes<v8u32, 8>(msgs, count, digests);
+}
+
+__attribute__((target("avx512f")))
+static void hash_lanes_avx512(lane_msg *msgs, size_t count, uint8_t (*digests)[20]){
+    hash_lanes<v16u32, 16>(msgs, count, digests);
+}
+
+#endif
+
+typedef void (*lanes_fn)(lane_msg *msgs, size_t count, uint8_t (*digests)[20]);
+
+struct multi_backend {
+    const char *name;
+    int lanes;
+    lanes_fn fn;
+};
+
+// TORRENT_SHA1_MULTI forces a lane engine ("avx512x16", "avx2x8", "sse2x4", "single")
+static multi_backend pick_multi(){
+    const char *forced = getenv("TORRENT_SHA1_MULTI");
+#ifdef SHA1_X86
+    const multi_backend engines[] = {
+        { "avx512x16", 16, hash_lanes_avx512 },
+        { "avx2x8",     8, hash_lanes_avx2 },
+        { "sse2x4",     4, hash_lanes_sse2 },
+    };
+    const bool supported[] = {
+        (bool)__builtin_cpu_supports("avx512f"),
+        (bool)__builtin_cpu_supports("avx2"),
+        (bool)__builtin_cpu_supports("sse2"),
+    };
+    for (int i = 0; i < 3; i++){
+        if (forced && strcmp(forced, engines[i].name) != 0) continue;
+        if (supported[i]) return engines[i];
+    }
+#endif
+    (void)forced;
+    return { "single", 1, nullptr };
+}
+
+static void hash_single(const uint8_t *data, size_t len, uint8_t *digest){
+    sha1 h;
+    h.add(data, len);
+    h.finalize();
+    h.print_bytes(digest);
+}
+
+static void hash_lanes_grouped(const multi_backend &mb, const uint8_t *const *data, const size_t *lens, size_t n, uint8_t (*digests)[20]){
+    // group messages of similar length so that no lane idles for long
+    std::vector<size_t> order(n);
+    for (size_t i = 0; i < n; i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t x, size_t y){ return lens[x] < lens[y]; });
+
+    std::vector<lane_msg> msgs(mb.lanes);
+    std::vector<uint8_t> out(mb.lanes * 20);
+    uint8_t (*lane_digests)[20] = reinterpret_cast<uint8_t (*)[20]>(out.data());
+    size_t pos = 0;
+    while (n - pos >= (size_t)(mb.lanes / 2) && n - pos >= 2){
+        size_t count = std::min((size_t)mb.lanes, n - pos);
+        for (size_t j = 0; j < count; j++) prepare_lane(msgs[j], data[order[pos + j]], lens[order[pos + j]]);
+        mb.fn(msgs.data(), count, lane_digests);
+        for (size_t j = 0; j < count; j++) memcpy(digests[order[pos + j]], lane_digests[j], 20);
+        pos += count;
+    }
+    for (; pos < n; pos++) hash_single(data[order[pos]], lens[order[pos]], digests[order[pos]]);
+}
+
+// SHA-NI hashes one stream at roughly the speed of an 8-lane AVX2 engine;
+// which one wins depends on the core, so time both once on a small batch.
+static bool lanes_beat_shani(const multi_backend &mb){
+    static std::once_flag once;
+    static bool result = false;
+    std::call_once(once, [&]{
+        const size_t len = 32 * 1024;
+        std::vector<uint8_t> buf(len * mb.lanes, 0x5a);
+        std::vector<const uint8_t*> ptrs(mb.lanes);
+        std::vector<size_t> lens(mb.lanes, len);
+        std::vector<uint8_t> out(mb.lanes * 20);
+        uint8_t (*digests)[20] = reinterpret_cast<uint8_t (*)[20]>(out.data());
+        for (int j = 0; j < mb.lanes; j++) ptrs[j] = buf.data() + j * len;
+
+        auto best = [&](bool lanes){
+            double t = 1e9;
+            for (int rep = 0; rep < 3; rep++){
+                auto t0 = std::chrono::steady_clock::now();
+                if (lanes) hash_lanes_grouped(mb, ptrs.data(), lens.data(), mb.lanes, digests);
+                else for (int j = 0; j < mb.lanes; j++) hash_single(ptrs[j], len, digests[j]);
+                t = std::min(t, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+            }
+            return t;
+        };
+        result = best(true) < best(false);
+    });
+    return result;
+}
+
+const char *multi_backend_name(){
+    multi_backend mb = pick_multi();
+    if (compress == compress_shani && (mb.lanes <= 1 || !lanes_beat_shani(mb))) return "shani";
+    return mb.name;
+}
+
+void hash_many(const uint8_t *const *data, const size_t *lens, size_t n, uint8_t (*digests)[20]){
+    multi_backend mb = pick_multi();
+
+    if (mb.lanes <= 1 || n < 2 || (compress == compress_shani && !lanes_beat_shani(mb))){
+        for (size_t i = 0; i < n; i++) hash_single(data[i], lens[i], digests[i]);
+        return;
+    }
+    hash_lanes_grouped(mb, data, lens, n, digests);
+}
+
+struct backend {
+    const char *name;
+    compress_fn fn;
+};
+
+static const backend backends[] = {
+    { "shani",  compress_shani  },
+    { "avx2",   compress_avx2   },
+    { "ssse3",  compress_ssse3  },
+    { "scalar", compress_scalar },
+};
+
+static const char *current_name = nullptr;
+
+// TORRENT_SHA1_BACKEND overrides detection (benchmarks, bug hunting)
+static void detect(){
+    const char *forced = getenv("TORRENT_SHA1_BACKEND");
+    for (const backend &b : backends){
+        if (forced && strcmp(forced, b.name) != 0) continue;
+        if (cpu_has(b.name)){
+            current_name = b.name;
+            compress = b.fn;
+            return;
+        }
+    }
+    current_name = "scalar";
+    compress = compress_scalar;
+}
+
+// the first call resolves the engine, so no static-init ordering is involved
+static void compress_first_call(uint32_t state[5], const uint8_t *ptr, size_t n_blocks){
+    detect();
+    compress(state, ptr, n_blocks);
+}
+
+compress_fn compress = compress_first_call;
+
+// resolved before main(), so worker threads never race on the pointer
+static const bool detected_at_startup = (detect(), true);
+
+const char *backend_name(){
+    if (!current_name) detect();
+    return current_name;
+}
+
+bool backend_supported(const char *name){
+    return cpu_has(name);
+}
+
+bool select_backend(const char *name){
+    for (const backend &b : backends){
+        if (strcmp(name, b.name) == 0 && cpu_has(b.name)){
+            current_name = b.name;
+            compress = b.fn;
+            return true;
+        }
+    }
+    return false;
+}
+
+}
@@ -3,10 +3,34 @@
 
 #include <cstdint>
 #include <cstring>
+#include <cstddef>
 
 #define SHA1_HEX_SIZE (40 + 1)
 #define SHA1_BASE64_SIZE (28 + 1)
 
+// Compression engines, selected once at startup from the CPU features
+// (SHA-NI, then AVX2/SSSE3 message schedule, then portable scalar).
+namespace sha1_engine {
+    typedef void (*compress_fn)(uint32_t state[5], const uint8_t *blocks, size_t n_blocks);
+
+    void compress_scalar(uint32_t state[5], const uint8_t *blocks, size_t n_blocks);
+    void compress_ssse3(uint32_t state[5], const uint8_t *blocks, size_t n_blocks);
+    void compress_avx2(uint32_t state[5], const uint8_t *blocks, size_t n_blocks);
+    void compress_shani(uint32_t state[5], const uint8_t *blocks, size_t n_blocks);
+
+    extern compress_fn compress;
+
+    const char *backend_name();
+    bool backend_supported(const char *name);
+    // forces a backend ("shani", "avx2", "ssse3", "scalar"), false if unsupported
+    bool select_backend(const char *name);
+
+    // Hashes n independent buffers at once (piece batches, rechecks):
+    // digests[i] receives the raw 20-byte SHA-1 of data[i][0..lens[i]).
+    void hash_many(const uint8_t *const *data, const size_t *lens, size_t n, uint8_t (*digests)[20]);
+    const char *multi_backend_name();
+}
+
 class sha1 {
 private:
 
@@ -15,140 +39,10 @@ private:
 
         if (i >= sizeof(buf)){
             i = 0;
-            process_block(buf);
+            sha1_engine::compress(state, buf, 1);
         }
     }
 
-    static uint32_t rol32(uint32_t x, uint32_t n){
-        return (x << n) | (x >> (32 - n));
-    }
-
-    static uint32_t make_word(const uint8_t *p){
-        return
-            ((uint32_t)p[0] << 3*8) |
-            ((uint32_t)p[1] << 2*8) |
-            ((uint32_t)p[2] << 1*8) |
-            ((uint32_t)p[3] << 0*8);
-    }
-
-    void process_block(const uint8_t *ptr){
-        const uint32_t c0 = 0x5a827999;
-        const uint32_t c1 = 0x6ed9eba1;
-        const uint32_t c2 = 0x8f1bbcdc;
-        const uint32_t c3 = 0xca62c1d6;
-
-        uint32_t a = state[0];
-        uint32_t b = state[1];
-        uint32_t c = state[2];
-        uint32_t d = state[3];
-        uint32_t e = state[4];
-
-        uint32_t w[16];
-
-        for (int i = 0; i < 16; i++) w[i] = make_word(ptr + i*4);
-
-#define SHA1_LOAD(i) w[i&15] = rol32(w[(i+13)&15] ^ w[(i+8)&15] ^ w[(i+2)&15] ^ w[i&15], 1);
-#define SHA1_ROUND_0(v,u,x,y,z,i)              z += ((u & (x ^ y)) ^ y) + w[i&15] + c0 + rol32(v, 5); u = rol32(u, 30);
-#define SHA1_ROUND_1(v,u,x,y,z,i) SHA1_LOAD(i) z += ((u & (x ^ y)) ^ y) + w[i&15] + c0 + rol32(v, 5); u = rol32(u, 30);
-#define SHA1_ROUND_2(v,u,x,y,z,i) SHA1_LOAD(i) z += (u ^ x ^ y) + w[i&15] + c1 + rol32(v, 5); u = rol32(u, 30);
-#define SHA1_ROUND_3(v,u,x,y,z,i) SHA1_LOAD(i) z += (((u | x) & y) | (u & x)) + w[i&15] + c2 + rol32(v, 5); u = rol32(u, 30);
-#define SHA1_ROUND_4(v,u,x,y,z,i) SHA1_LOAD(i) z += (u ^ x ^ y) + w[i&15] + c3 + rol32(v, 5); u = rol32(u, 30);
-
-        SHA1_ROUND_0(a, b, c, d, e,  0);
-        SHA1_ROUND_0(e, a, b, c, d,  1);
-        SHA1_ROUND_0(d, e, a, b, c,  2);
-        SHA1_ROUND_0(c, d, e, a, b,  3);
-        SHA1_ROUND_0(b, c, d, e, a,  4);
-        SHA1_ROUND_0(a, b, c, d, e,  5);
-        SHA1_ROUND_0(e, a, b, c, d,  6);
-        SHA1_ROUND_0(d, e, a, b, c,  7);
-        SHA1_ROUND_0(c, d, e, a, b,  8);
-        SHA1_ROUND_0(b, c, d, e, a,  9);
-        SHA1_ROUND_0(a, b, c, d, e, 10);
-        SHA1_ROUND_0(e, a, b, c, d, 11);
-        SHA1_ROUND_0(d, e, a, b, c, 12);
-        SHA1_ROUND_0(c, d, e, a, b, 13);
-        SHA1_ROUND_0(b, c, d, e, a, 14);
-        SHA1_ROUND_0(a, b, c, d, e, 15);
-        SHA1_ROUND_1(e, a, b, c, d, 16);
-        SHA1_ROUND_1(d, e, a, b, c, 17);
-        SHA1_ROUND_1(c, d, e, a, b, 18);
-        SHA1_ROUND_1(b, c, d, e, a, 19);
-        SHA1_ROUND_2(a, b, c, d, e, 20);
-        SHA1_ROUND_2(e, a, b, c, d, 21);
-        SHA1_ROUND_2(d, e, a, b, c, 22);
-        SHA1_ROUND_2(c, d, e, a, b, 23);
-        SHA1_ROUND_2(b, c, d, e, a, 24);
-        SHA1_ROUND_2(a, b, c, d, e, 25);
-        SHA1_ROUND_2(e, a, b, c, d, 26);
-        SHA1_ROUND_2(d, e, a, b, c, 27);
-        SHA1_ROUND_2(c, d, e, a, b, 28);
-        SHA1_ROUND_2(b, c, d, e, a, 29);
-        SHA1_ROUND_2(a, b, c, d, e, 30);
-        SHA1_ROUND_2(e, a, b, c, d, 31);
-        SHA1_ROUND_2(d, e, a, b, c, 32);
-        SHA1_ROUND_2(c, d, e, a, b, 33);
-        SHA1_ROUND_2(b, c, d, e, a, 34);
-        SHA1_ROUND_2(a, b, c, d, e, 35);
-        SHA1_ROUND_2(e, a, b, c, d, 36);
-        SHA1_ROUND_2(d, e, a, b, c, 37);
-        SHA1_ROUND_2(c, d, e, a, b, 38);
-        SHA1_ROUND_2(b, c, d, e, a, 39);
-        SHA1_ROUND_3(a, b, c, d, e, 40);
-        SHA1_ROUND_3(e, a, b, c, d, 41);
-        SHA1_ROUND_3(d, e, a, b, c, 42);
-        SHA1_ROUND_3(c, d, e, a, b, 43);
-        SHA1_ROUND_3(b, c, d, e, a, 44);
-        SHA1_ROUND_3(a, b, c, d, e, 45);
-        SHA1_ROUND_3(e, a, b, c, d, 46);
-        SHA1_ROUND_3(d, e, a, b, c, 47);
-        SHA1_ROUND_3(c, d, e, a, b, 48);
-        SHA1_ROUND_3(b, c, d, e, a, 49);
-        SHA1_ROUND_3(a, b, c, d, e, 50);
-        SHA1_ROUND_3(e, a, b, c, d, 51);
-        SHA1_ROUND_3(d, e, a, b, c, 52);
-        SHA1_ROUND_3(c, d, e, a, b, 53);
-        SHA1_ROUND_3(b, c, d, e, a, 54);
-        SHA1_ROUND_3(a, b, c, d, e, 55);
-        SHA1_ROUND_3(e, a, b, c, d, 56);
-        SHA1_ROUND_3(d, e, a, b, c, 57);
-        SHA1_ROUND_3(c, d, e, a, b, 58);
-        SHA1_ROUND_3(b, c, d, e, a, 59);
-        SHA1_ROUND_4(a, b, c, d, e, 60);
-        SHA1_ROUND_4(e, a, b, c, d, 61);
-        SHA1_ROUND_4(d, e, a, b, c, 62);
-        SHA1_ROUND_4(c, d, e, a, b, 63);
-        SHA1_ROUND_4(b, c, d, e, a, 64);
-        SHA1_ROUND_4(a, b, c, d, e, 65);
-        SHA1_ROUND_4(e, a, b, c, d, 66);
-        SHA1_ROUND_4(d, e, a, b, c, 67);
-        SHA1_ROUND_4(c, d, e, a, b, 68);
-        SHA1_ROUND_4(b, c, d, e, a, 69);
-        SHA1_ROUND_4(a, b, c, d, e, 70);
-        SHA1_ROUND_4(e, a, b, c, d, 71);
-        SHA1_ROUND_4(d, e, a, b, c, 72);
-        SHA1_ROUND_4(c, d, e, a, b, 73);
-        SHA1_ROUND_4(b, c, d, e, a, 74);
-        SHA1_ROUND_4(a, b, c, d, e, 75);
-        SHA1_ROUND_4(e, a, b, c, d, 76);
-        SHA1_ROUND_4(d, e, a, b, c, 77);
-        SHA1_ROUND_4(c, d, e, a, b, 78);
-        SHA1_ROUND_4(b, c, d, e, a, 79);
-
-#undef SHA1_LOAD
-#undef SHA1_ROUND_0
-#undef SHA1_ROUND_1
-#undef SHA1_ROUND_2
-#undef SHA1_ROUND_3
-#undef SHA1_ROUND_4
-
-        state[0] += a;
-        state[1] += b;
-        state[2] += c;
-        state[3] += d;
-        state[4] += e;
-    }
-
 public:
 
     uint32_t state[5];
@@ -175,23 +69,36 @@ public:
         return add(*(uint8_t*)&c);
     }
 
-    sha1& add(const void *data, uint32_t n){
-        if (!data) return *this;
+    sha1& add(const void *data, size_t n){
+        if (!data || !n) return *this;
 
         const uint8_t *ptr = (const uint8_t*)data;
+        n_bits += (uint64_t)n * 8;
 
         // fill up block if not full
-        for (; n && i % sizeof(buf); n--) add(*ptr++);
+        if (i){
+            size_t take = sizeof(buf) - i;
+            if (take > n) take = n;
+            memcpy(buf + i, ptr, take);
+            i += take;
+            ptr += take;
+            n -= take;
+            if (i < sizeof(buf)) return *this;
+            sha1_engine::compress(state, buf, 1);
+            i = 0;
+        }
 
         // process full blocks
-        for (; n >= sizeof(buf); n -= sizeof(buf)){
-            process_block(ptr);
-            ptr += sizeof(buf);
-            n_bits += sizeof(buf) * 8;
+        size_t n_blocks = n / sizeof(buf);
+        if (n_blocks){
+            sha1_engine::compress(state, ptr, n_blocks);
+            ptr += n_blocks * sizeof(buf);
+            n -= n_blocks * sizeof(buf);
         }
 
         // process remaining part of block
-        for (; n; n--) add(*ptr++);
+        memcpy(buf, ptr, n);
+        i = n;
 
         return *this;
     }
@@ -203,9 +110,16 @@ public:
 
     sha1& finalize(){
         // hashed text ends with 0x80, some padding 0x00 and the length in bits
-        add_byte_dont_count_bits(0x80);
-        while (i % 64 != 56) add_byte_dont_count_bits(0x00);
-        for (int j = 7; j >= 0; j--) add_byte_dont_count_bits(n_bits >> j * 8);
+        buf[i++] = 0x80;
+        if (i > 56){
+            memset(buf + i, 0, sizeof(buf) - i);
+            sha1_engine::compress(state, buf, 1);
+            i = 0;
+        }
+        memset(buf + i, 0, 56 - i);
+        for (int j = 7; j >= 0; j--) buf[63 - j] = (uint8_t)(n_bits >> j * 8);
+        sha1_engine::compress(state, buf, 1);
+        i = 0;
 
         return *this;
     }
@@ -226,6 +140,17 @@ public:
         return *this;
     }
 
+    const sha1& print_bytes(uint8_t *out) const {
+        // raw big-endian digest, 20 bytes
+        for (int i = 0; i < 5; i++){
+            out[i*4 + 0] = (state[i] >> 24) & 0xff;
+            out[i*4 + 1] = (state[i] >> 16) & 0xff;
+            out[i*4 + 2] = (state[i] >> 8) & 0xff;
+            out[i*4 + 3] = (state[i]) & 0xff;
+        }
+        return *this;
+    }
+
     const sha1& print_base64(char *base64, bool zero_terminate = true) const {
         static const uint8_t *table = (const uint8_t*)
             "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
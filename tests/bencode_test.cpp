@@ -0,0 +1,98 @@
+// Input bencode troncati o fuori limite: BencodeDocument e BencodeReader
+// devono rifiutarli senza leggere oltre il buffer, e accettare quelli validi.
+// Stato di uscita 0 se tutti i casi danno l'esito atteso.
+#include "Bnode.hpp"
+#include "BencodeReader.hpp"
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+// Conta soltanto gli eventi: basta sapere se l'input e' valido
+struct Counter {
+    size_t events = 0;
+    bool onInt(std::string_view, long long, int) { events++; return true; }
+    bool onString(std::string_view, std::string_view, int) { events++; return true; }
+    bool onBegin(std::string_view, bool, int) { events++; return true; }
+    bool onEnd(int) { events++; return true; }
+};
+
+// Copia esatta in un buffer a parte: con ASan un byte letto oltre la fine viene segnalato
+static void expect(const std::string& input, bool valid) {
+    std::vector<char> buf(input.begin(), input.end());
+    const char* data = buf.empty() ? "" : buf.data();
+
+    BencodeDocument doc;
+    bool domOk = doc.parse(data, buf.size());
+    Counter counter;
+    bool saxOk = BencodeReader().read(data, buf.size(), counter) == BencodeReader::DONE;
+
+    if (domOk != valid || saxOk != valid) {
+        printf("FAIL \"%s\": atteso %s, DOM %s, reader %s\n", input.c_str(), valid ? "valido" : "invalido",
+               domOk ? "valido" : "invalido", saxOk ? "valido" : "invalido");
+        failures++;
+    }
+}
+
+static void expectInt(const std::string& input, long long value) {
+    BencodeDocument doc;
+    if (!doc.parse(input.data(), input.size()) || doc.root()->type != INTEGER || doc.root()->int_val != value) {
+        printf("FAIL \"%s\": atteso l'intero %lld\n", input.c_str(), value);
+        failures++;
+    }
+}
+
+int main() {
+    // Stringhe con la lunghezza oltre la fine dell'input ("5:ab" era accettata)
+    expect("4:spam", true);
+    expect("0:", true);
+    expect("5:ab", false);
+    expect("9:ab", false);
+    expect("3:", false);
+    expect("10:abcdefghi", false);
+    expect("1", false);
+    expect("4", false);
+    expect(":", false);
+    expect("", false);
+    expect("99999999999999999999:a", false);
+    expect("184467440737095516160:", false);
+    expect("-1:a", false);
+
+    // Interi troncati o fuori dall'intervallo di long long
+    expect("i42e", true);
+    expect("i-7e", true);
+    expect("i", false);
+    expect("i4", false);
+    expect("i42", false);
+    expect("i-", false);
+    expect("ie", false);
+    expect("i-e", false);
+    expect("i4x2e", false);
+    expect("i9223372036854775807e", true);
+    expect("i-9223372036854775808e", true);
+    expect("i9223372036854775808e", false);
+    expect("i-9223372036854775809e", false);
+    expect("i99999999999999999999e", false);
+    expectInt("i9223372036854775807e", 9223372036854775807LL);
+    expectInt("i-9223372036854775808e", -9223372036854775807LL - 1);
+
+    // Contenitori troncati a ogni punto
+    const std::string full = "d4:infod6:lengthi1024e4:name3:abc6:piecesl2:xy0:ee3:numi-3ee";
+    expect(full, true);
+    for (size_t cut = 0; cut < full.size(); ++cut) expect(full.substr(0, cut), false);
+
+    // Chiavi non stringa e contenitori non chiusi
+    expect("di1ei2ee", false);
+    expect("l", false);
+    expect("d", false);
+    expect("le", true);
+    expect("de", true);
+
+    if (failures) {
+        printf("%d errori\n", failures);
+        return 1;
+    }
+    printf("bencode: tutti i casi OK\n");
+    return 0;
+}
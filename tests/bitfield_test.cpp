@@ -0,0 +1,84 @@
+// Kernel dei bitfield: ogni backend supportato dalla CPU contro un conteggio
+// bit per bit, su bitfield casuali lunghi un numero di bit che non e'
+// multiplo di 64 ne' di 256, cosi' da passare per la coda scalare dei kernel
+// vettoriali e per validMask dell'ultima parola.
+// Stato di uscita 0 se tutti i backend danno i risultati attesi.
+#include "../PieceManager/bitfield.hpp"
+#include <cstdio>
+#include <random>
+#include <vector>
+
+static const char* const backends[] = { "avx2", "popcnt", "scalar" };
+
+static int failures = 0;
+
+static bool bitOf(const std::vector<uint8_t>& bytes, size_t i) { return bytes[i / 8] & (0x80 >> (i % 8)); }
+
+static void check(const char* backend, const char* what, size_t numBits, size_t got, size_t want) {
+    if (got != want) {
+        printf("FAIL %s %s, %zu bit: %zu, attesi %zu\n", backend, what, numBits, got, want);
+        failures++;
+    }
+}
+
+// Due bitfield di numBits bit con densita' diverse; i byte oltre l'ultimo
+// pezzo arrivano sporchi, come da un peer che non rispetta il protocollo
+static void compare(const char* backend, size_t numBits, std::mt19937_64& rng) {
+    Bitfield a(numBits), b(numBits);
+    std::vector<uint8_t> ra(a.byteSize()), rb(b.byteSize());
+    uint64_t density = rng() % 4;
+    for (size_t i = 0; i < ra.size(); ++i) {
+        uint64_t r = rng();
+        ra[i] = (uint8_t)r;
+        rb[i] = density == 0 ? (uint8_t)(r >> 8) : density == 1 ? (uint8_t)r : (uint8_t)((r >> 8) | r);
+    }
+    a.fromBytes(ra.data(), ra.size());
+    b.fromBytes(rb.data(), rb.size());
+
+    size_t wantCount = 0, wantAndnot = 0;
+    for (size_t i = 0; i < numBits; ++i) {
+        wantCount += bitOf(ra, i);
+        wantAndnot += bitOf(ra, i) && !bitOf(rb, i);
+    }
+    check(backend, "count", numBits, a.count(), wantCount);
+    check(backend, "count_andnot", numBits, bitfield_ops::count_andnot(a.raw(), b.raw(), a.wordCount()), wantAndnot);
+    check(backend, "any_andnot", numBits, bitfield_ops::any_andnot(a.raw(), b.raw(), a.wordCount()), wantAndnot > 0);
+
+    // Un solo bit di differenza, in ogni posizione della coda
+    for (size_t bit = numBits > 300 ? numBits - 300 : 0; bit < numBits; ++bit) {
+        Bitfield c(numBits);
+        c.fromBytes(ra.data(), ra.size());
+        std::vector<uint8_t> without = ra;
+        without[bit / 8] &= ~(0x80 >> (bit % 8));
+        Bitfield d(numBits);
+        d.fromBytes(without.data(), without.size());
+        size_t want = bitOf(ra, bit);
+        check(backend, "count_andnot di un bit", numBits, bitfield_ops::count_andnot(c.raw(), d.raw(), c.wordCount()), want);
+        check(backend, "any_andnot di un bit", numBits, bitfield_ops::any_andnot(c.raw(), d.raw(), c.wordCount()), want);
+    }
+}
+
+int main() {
+    std::mt19937_64 rng(1);
+    std::vector<size_t> sizes = { 1, 7, 8, 63, 64, 65, 200, 255, 256, 257, 511, 1000, 1025, 4093, 100003 };
+    for (int i = 0; i < 50; ++i) sizes.push_back(1 + rng() % 20000);
+
+    int tested = 0;
+    for (const char* backend : backends) {
+        if (!bitfield_ops::select_backend(backend)) {
+            printf("  %-8s non supportato\n", backend);
+            continue;
+        }
+        int before = failures;
+        for (size_t numBits : sizes) compare(backend, numBits, rng);
+        printf("  %-8s %s\n", backend, failures == before ? "ok" : "ERRATO");
+        tested++;
+    }
+
+    if (tested == 0 || failures) {
+        printf("%d errori\n", failures);
+        return 1;
+    }
+    printf("bitfield: tutti i backend OK\n");
+    return 0;
+}
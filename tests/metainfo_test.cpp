@@ -0,0 +1,64 @@
+// Metadati del .torrent: TorrentFile::load deve rifiutare i torrent che
+// nessun componente a valle sa gestire (vuoti, hash in numero sbagliato) e
+// accettare quelli coerenti. Stato di uscita 0 se tutti i casi danno l'esito atteso.
+#include "TorrentFile.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <fstream>
+
+static int failures = 0;
+
+static std::string bstr(const std::string& s) { return std::to_string(s.size()) + ":" + s; }
+
+static std::string torrent(const std::string& info) {
+    return "d8:announce" + bstr("udp://127.0.0.1:6969/announce") + "4:infod" + info + "ee";
+}
+
+static void expect(const char* what, const std::string& data, bool valid, uint32_t pieces = 0) {
+    std::string path = std::string(std::getenv("TMPDIR") ? std::getenv("TMPDIR") : "/tmp") + "/metainfo_test.torrent";
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), data.size());
+    }
+    TorrentFile tf;
+    bool ok = tf.load(path);
+    std::remove(path.c_str());
+
+    if (ok != valid) {
+        printf("FAIL %s: atteso %s\n", what, valid ? "valido" : "invalido");
+        failures++;
+    } else if (ok && tf.getMetainfo().num_pieces != pieces) {
+        printf("FAIL %s: %u pezzi, attesi %u\n", what, tf.getMetainfo().num_pieces, pieces);
+        failures++;
+    }
+}
+
+int main() {
+    std::string hash(20, 'h');
+
+    expect("file singolo", torrent("6:lengthi1000e4:name3:abc12:piece lengthi512e6:pieces" + bstr(hash + hash)), true, 2);
+    expect("multi-file", torrent("5:filesld6:lengthi0e4:pathl1:aeed6:lengthi10e4:pathl1:beee4:name3:abc"
+                                 "12:piece lengthi512e6:pieces" + bstr(hash)), true, 1);
+
+    // Torrent vuoti: zero pezzi mandavano fuori limite bitfield e divisioni in main
+    expect("file singolo vuoto", torrent("6:lengthi0e4:name3:abc12:piece lengthi512e6:pieces0:"), false);
+    expect("file tutti vuoti", torrent("5:filesld6:lengthi0e4:pathl1:aeed6:lengthi0e4:pathl1:beee4:name3:abc"
+                                       "12:piece lengthi512e6:pieces0:"), false);
+    expect("nessun file", torrent("5:filesle4:name3:abc12:piece lengthi512e6:pieces0:"), false);
+    expect("vuoto con un hash", torrent("6:lengthi0e4:name3:abc12:piece lengthi512e6:pieces" + bstr(hash)), false);
+
+    // Hash in numero sbagliato o incompleti
+    expect("hash mancante", torrent("6:lengthi1000e4:name3:abc12:piece lengthi512e6:pieces" + bstr(hash)), false);
+    expect("hash in piu'", torrent("6:lengthi10e4:name3:abc12:piece lengthi512e6:pieces" + bstr(hash + hash)), false);
+    expect("hash troncato", torrent("6:lengthi10e4:name3:abc12:piece lengthi512e6:pieces" + bstr(hash.substr(1))), false);
+    expect("piece length nulla", torrent("6:lengthi10e4:name3:abc12:piece lengthi0e6:pieces" + bstr(hash)), false);
+    expect("lunghezza negativa", torrent("6:lengthi-10e4:name3:abc12:piece lengthi512e6:pieces0:"), false);
+
+    if (failures) {
+        printf("%d errori\n", failures);
+        return 1;
+    }
+    printf("metainfo: tutti i casi OK\n");
+    return 0;
+}
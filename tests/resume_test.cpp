@@ -0,0 +1,235 @@
+// Registro di resume dopo un crash in qualunque punto: un journal troncato o
+// corrotto a ogni byte dell'ultimo gruppo deve restituire solo i gruppi
+// completi che lo precedono, e istantanea e journal di generazioni diverse
+// non devono mescolarsi. Stato di uscita 0 se tutti i casi danno l'esito atteso.
+#include "../PieceManager/resumeJournal.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <filesystem>
+
+static const uint32_t NUM_PIECES = 50;
+static const size_t NUM_FILES = 3;
+
+static int failures = 0;
+
+struct Group {
+    std::vector<uint32_t> pieces;
+    std::vector<std::pair<uint32_t, FileStamp>> stamps;
+};
+
+// Stato atteso dopo una load: quello dell'istantanea piu' i gruppi applicati
+struct State {
+    std::vector<uint8_t> bitfield = std::vector<uint8_t>((NUM_PIECES + 7) / 8, 0);
+    std::vector<FileStamp> stamps = std::vector<FileStamp>(NUM_FILES);
+    std::vector<PartialPiece> partials;
+
+    void apply(const Group& g) {
+        for (uint32_t i : g.pieces) bitfield[i / 8] |= 0x80 >> (i % 8);
+        for (const auto& s : g.stamps) stamps[s.first] = s.second;
+        std::vector<PartialPiece> left;
+        for (const PartialPiece& p : partials)
+            if (!(bitfield[p.index / 8] & (0x80 >> (p.index % 8)))) left.push_back(p);
+        partials = left;
+    }
+};
+
+static std::vector<uint8_t> readBytes(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static void writeBytes(const std::string& path, const std::vector<uint8_t>& data, size_t len) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(data.data()), len);
+}
+
+static bool same(const State& a, const State& b) {
+    if (a.bitfield != b.bitfield || a.partials.size() != b.partials.size()) return false;
+    for (size_t f = 0; f < NUM_FILES; ++f)
+        if (a.stamps[f].size != b.stamps[f].size || a.stamps[f].mtime != b.stamps[f].mtime) return false;
+    for (size_t i = 0; i < a.partials.size(); ++i)
+        if (a.partials[i].index != b.partials[i].index || a.partials[i].blocks != b.partials[i].blocks) return false;
+    return true;
+}
+
+// Ricarica base e confronta con lo stato atteso; ok e' l'esito atteso di load
+static void expect(const char* what, size_t detail, const std::string& base, bool ok, const State& want) {
+    ResumeJournal journal(base);
+    State got;
+    bool loaded = journal.load(NUM_PIECES, NUM_FILES, got.bitfield, got.stamps, got.partials);
+    if (loaded != ok || !same(got, want)) {
+        printf("FAIL %s (%zu): load %s, stato %s\n", what, detail, loaded ? "riuscita" : "fallita",
+               same(got, want) ? "atteso" : "diverso");
+        failures++;
+    }
+}
+
+int main() {
+    char tmpl[] = "/tmp/resume_test.XXXXXX";
+    if (!mkdtemp(tmpl)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    const std::string dir = tmpl;
+    const std::string base = dir + "/t";
+    const std::string snapshotPath = base + ".resume";
+    const std::string journalPath = base + ".journal";
+
+    // Primo avvio: nessun registro, load crea un'istantanea vuota
+    State initial;
+    expect("registro assente", 0, base, false, initial);
+
+    // Istantanea con un pezzo completo e due incompleti, poi tre gruppi
+    State snapshot;
+    snapshot.bitfield[0] = 0x80;
+    snapshot.stamps[0] = {1000, 1};
+    snapshot.partials = {{7, {0xf0}}, {9, {0x80, 0x01}}};
+    std::vector<Group> groups = {
+        {{1, 2}, {{0, {2000, 2}}}},
+        {{3}, {{1, {500, 3}}}},
+        {{7, 4, 49}, {{2, {10, 4}}, {0, {3000, 5}}}},
+    };
+    std::vector<size_t> groupEnd;
+    {
+        ResumeJournal journal(base);
+        State s;
+        journal.load(NUM_PIECES, NUM_FILES, s.bitfield, s.stamps, s.partials);
+        journal.compact(snapshot.bitfield, snapshot.stamps, snapshot.partials);
+        groupEnd.push_back(journal.journalBytes());
+        for (const Group& g : groups) {
+            journal.commit(g.pieces, g.stamps);
+            groupEnd.push_back(journal.journalBytes());
+        }
+    }
+    const std::vector<uint8_t> snapBytes = readBytes(snapshotPath);
+    const std::vector<uint8_t> journalBytes = readBytes(journalPath);
+    if (journalBytes.size() != groupEnd.back()) {
+        printf("FAIL journal di %zu byte, attesi %zu\n", journalBytes.size(), groupEnd.back());
+        failures++;
+    }
+
+    std::vector<State> after(1, snapshot);
+    for (const Group& g : groups) {
+        after.push_back(after.back());
+        after.back().apply(g);
+    }
+    expect("journal completo", journalBytes.size(), base, true, after[3]);
+
+    // Crash durante la scrittura dell'ultimo gruppo: troncato a ogni byte
+    size_t lastStart = groupEnd[2];
+    for (size_t len = lastStart; len < journalBytes.size(); ++len) {
+        writeBytes(snapshotPath, snapBytes, snapBytes.size());
+        writeBytes(journalPath, journalBytes, len);
+        expect("ultimo gruppo troncato", len, base, true, after[2]);
+
+        // La coda incompleta va tagliata: un gruppo aggiunto dopo deve restare leggibile
+        {
+            ResumeJournal journal(base);
+            State s;
+            journal.load(NUM_PIECES, NUM_FILES, s.bitfield, s.stamps, s.partials);
+            if (journal.journalBytes() != lastStart || std::filesystem::file_size(journalPath) != lastStart) {
+                printf("FAIL coda non tagliata (%zu): %zu byte, attesi %zu\n", len, journal.journalBytes(), lastStart);
+                failures++;
+            }
+            journal.commit(groups[2].pieces, groups[2].stamps);
+        }
+        expect("gruppo dopo una coda troncata", len, base, true, after[3]);
+    }
+
+    // Byte corrotto nell'ultimo gruppo: scartato, i precedenti restano
+    for (size_t off = lastStart; off < journalBytes.size(); ++off) {
+        std::vector<uint8_t> bad = journalBytes;
+        bad[off] ^= 0x5a;
+        writeBytes(snapshotPath, snapBytes, snapBytes.size());
+        writeBytes(journalPath, bad, bad.size());
+        expect("ultimo gruppo corrotto", off, base, true, after[2]);
+    }
+
+    // Byte corrotto in un gruppo intermedio: scartato con tutti i successivi
+    for (size_t off = groupEnd[1]; off < groupEnd[2]; ++off) {
+        std::vector<uint8_t> bad = journalBytes;
+        bad[off] ^= 0x5a;
+        writeBytes(snapshotPath, snapBytes, snapBytes.size());
+        writeBytes(journalPath, bad, bad.size());
+        expect("gruppo intermedio corrotto", off, base, true, after[1]);
+    }
+
+    // Istantanea corrotta o troncata: non vale nulla, nemmeno il journal
+    for (size_t off = 0; off < snapBytes.size(); ++off) {
+        std::vector<uint8_t> bad = snapBytes;
+        bad[off] ^= 0x5a;
+        writeBytes(snapshotPath, bad, bad.size());
+        writeBytes(journalPath, journalBytes, journalBytes.size());
+        expect("istantanea corrotta", off, base, false, initial);
+    }
+    for (size_t len = 0; len < snapBytes.size(); ++len) {
+        writeBytes(snapshotPath, snapBytes, len);
+        writeBytes(journalPath, journalBytes, journalBytes.size());
+        expect("istantanea troncata", len, base, false, initial);
+    }
+
+    // Compattazione: la nuova istantanea include i gruppi, il journal riparte vuoto
+    writeBytes(snapshotPath, snapBytes, snapBytes.size());
+    writeBytes(journalPath, journalBytes, journalBytes.size());
+    Group late = {{20}, {{1, {600, 6}}}};
+    State compacted = after[3];
+    State newer = compacted;
+    newer.apply(late);
+    {
+        ResumeJournal journal(base);
+        State s;
+        journal.load(NUM_PIECES, NUM_FILES, s.bitfield, s.stamps, s.partials);
+        journal.compact(s.bitfield, s.stamps, s.partials);
+        journal.commit(late.pieces, late.stamps);
+    }
+    expect("dopo la compattazione", 0, base, true, newer);
+    const std::vector<uint8_t> newSnap = readBytes(snapshotPath);
+    const std::vector<uint8_t> newJournal = readBytes(journalPath);
+
+    // Crash tra il rename dell'istantanea e il reset del journal: il journal
+    // della generazione precedente e' gia' incluso e non va riapplicato
+    writeBytes(snapshotPath, newSnap, newSnap.size());
+    writeBytes(journalPath, journalBytes, journalBytes.size());
+    expect("journal di una generazione precedente", 0, base, true, compacted);
+
+    // Istantanea vecchia con un journal di una generazione successiva: i
+    // gruppi non appartengono a quell'istantanea e vanno ignorati
+    writeBytes(snapshotPath, snapBytes, snapBytes.size());
+    writeBytes(journalPath, newJournal, newJournal.size());
+    expect("journal di una generazione successiva", 0, base, true, snapshot);
+
+    // Dopo quella load il journal riparte dalla generazione dell'istantanea
+    {
+        ResumeJournal journal(base);
+        State s;
+        journal.load(NUM_PIECES, NUM_FILES, s.bitfield, s.stamps, s.partials);
+        journal.commit(late.pieces, late.stamps);
+    }
+    State oldPlusLate = snapshot;
+    oldPlusLate.apply(late);
+    expect("gruppo dopo il journal scartato", 0, base, true, oldPlusLate);
+
+    // Registro di un altro torrent
+    writeBytes(snapshotPath, newSnap, newSnap.size());
+    writeBytes(journalPath, newJournal, newJournal.size());
+    {
+        ResumeJournal journal(base);
+        State s;
+        if (journal.load(NUM_PIECES + 1, NUM_FILES, s.bitfield, s.stamps, s.partials)) {
+            printf("FAIL registro accettato con un numero di pezzi diverso\n");
+            failures++;
+        }
+    }
+
+    std::filesystem::remove_all(dir);
+    if (failures) {
+        printf("%d errori\n", failures);
+        return 1;
+    }
+    printf("resume: tutti i casi OK\n");
+    return 0;
+}
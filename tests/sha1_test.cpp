@@ -0,0 +1,133 @@
+// SHA-1 engines against the FIPS 180 vectors and against each other: every
+// compression backend the CPU supports, and hash_many with every lane engine.
+// Exit status 0 when everything matches.
+#include "sha1.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <random>
+
+static const char *const backends[] = { "scalar", "ssse3", "avx2", "shani" };
+static const char *const lane_engines[] = { "single", "sse2x4", "avx2x8", "avx512x16" };
+
+static int failures = 0;
+
+static void check(bool ok, const char *backend, const char *what){
+    if (ok) return;
+    printf("FAIL [%s] %s\n", backend, what);
+    failures++;
+}
+
+// hashes data[0..len) in two add() calls split at split
+static std::string hex_of(const void *data, size_t len, size_t split = 0){
+    sha1 h;
+    h.add(data, split);
+    h.add((const uint8_t*)data + split, len - split);
+    h.finalize();
+    char hex[SHA1_HEX_SIZE];
+    h.print_hex(hex);
+    return hex;
+}
+
+static void test_vectors(const char *backend){
+    static const struct { const char *msg; const char *digest; } vectors[] = {
+        { "", "da39a3ee5e6b4b0d3255bfef95601890afd80709" },
+        { "abc", "a9993e364706816aba3e25717850c26c9cd0d89d" },
+        { "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+          "84983e441c3bd26ebaae4aa1f95129e5e54670f1" },
+        { "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu",
+          "a49b2446a02c645bf419f995b67091253a04a259" },
+    };
+    for (const auto &v : vectors){
+        size_t len = strlen(v.msg);
+        for (size_t split = 0; split <= len; split++){
+            check(hex_of(v.msg, len, split) == v.digest, backend, v.msg);
+        }
+    }
+
+    std::string million(1000000, 'a');
+    check(hex_of(million.data(), million.size()) == "34aa973cd4c4daa4f61eeb2bdbad27316534016f", backend, "million 'a'");
+    check(hex_of(million.data(), million.size(), 333) == "34aa973cd4c4daa4f61eeb2bdbad27316534016f", backend, "million 'a', split");
+}
+
+int main(){
+    std::mt19937 rng(20240917);
+    std::vector<uint8_t> data(1 << 20);
+    for (auto &b : data) b = (uint8_t)rng();
+
+    // random inputs with a random split point, scalar digests as reference
+    struct Input { size_t offset, len, split; };
+    std::vector<Input> inputs(3000);
+    for (auto &in : inputs){
+        in.len = rng() % 5000;
+        in.offset = rng() % (data.size() - in.len);
+        in.split = in.len ? rng() % in.len : 0;
+    }
+
+    // batches for hash_many: mostly piece-sized, some shorter than a block
+    struct Batch { std::vector<const uint8_t*> ptrs; std::vector<size_t> lens; };
+    std::vector<Batch> batches(60);
+    for (size_t k = 0; k < batches.size(); k++){
+        size_t n = 1 + rng() % 40;
+        for (size_t i = 0; i < n; i++){
+            size_t len = k % 3 == 0 ? rng() % 200 : rng() % 100000;
+            batches[k].lens.push_back(len);
+            batches[k].ptrs.push_back(data.data() + rng() % (data.size() - len));
+        }
+    }
+
+    sha1_engine::select_backend("scalar");
+    test_vectors("scalar");
+    std::vector<std::string> reference;
+    for (const auto &in : inputs) reference.push_back(hex_of(data.data() + in.offset, in.len));
+    std::vector<std::vector<std::string>> batch_reference;
+    for (const auto &b : batches){
+        batch_reference.emplace_back();
+        for (size_t i = 0; i < b.ptrs.size(); i++) batch_reference.back().push_back(hex_of(b.ptrs[i], b.lens[i]));
+    }
+
+    int tested = 0;
+    for (const char *backend : backends){
+        if (!sha1_engine::select_backend(backend)){
+            printf("skip [%s] not supported by this CPU\n", backend);
+            continue;
+        }
+        tested++;
+        test_vectors(backend);
+
+        for (size_t t = 0; t < inputs.size(); t++){
+            const Input &in = inputs[t];
+            if (hex_of(data.data() + in.offset, in.len, in.split) != reference[t]){
+                check(false, backend, "random split input");
+                break;
+            }
+        }
+
+        // with SHA-NI, hash_many may bypass the lanes: the scalar rounds keep them in use
+        for (const char *engine : lane_engines){
+            setenv("TORRENT_SHA1_MULTI", engine, 1);
+            std::string label = std::string(backend) + "/" + sha1_engine::multi_backend_name();
+            for (size_t k = 0; k < batches.size(); k++){
+                const Batch &b = batches[k];
+                std::vector<uint8_t> out(b.ptrs.size() * 20);
+                uint8_t (*digests)[20] = reinterpret_cast<uint8_t (*)[20]>(out.data());
+                sha1_engine::hash_many(b.ptrs.data(), b.lens.data(), b.ptrs.size(), digests);
+
+                for (size_t i = 0; i < b.ptrs.size(); i++){
+                    char hex[SHA1_HEX_SIZE];
+                    for (int j = 0; j < 20; j++) snprintf(hex + 2 * j, 3, "%02x", digests[i][j]);
+                    check(batch_reference[k][i] == hex, label.c_str(), "hash_many batch");
+                }
+            }
+        }
+        unsetenv("TORRENT_SHA1_MULTI");
+    }
+
+    if (failures){
+        printf("%d failure(s)\n", failures);
+        return 1;
+    }
+    printf("sha1: %d backend(s) OK\n", tested);
+    return 0;
+}